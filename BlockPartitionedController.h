@@ -0,0 +1,339 @@
+#ifndef BLOCK_PARTITIONED_CONTROLLER_H
+#define BLOCK_PARTITIONED_CONTROLLER_H
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "HierDiffController.h"
+
+const int MAX_BLOCKS = 64;                               // Touched blocks fit one directory mask
+
+/**
+ * Options of a block-partitioned controller.
+ */
+struct BlockPartitionConfig {
+    int block_rows = 4096;                                // Rows (bits) per block, a multiple of 8
+    ControllerConfig block_config;                        // Passed to every block controller
+};
+
+/**
+ * One committed CSN in the cross-block directory.
+ */
+struct BlockDirectoryEntry {
+    int csn;
+    uint64_t touched;                                     // Blocks that changed at this CSN
+    std::atomic<bool> published;                          // Every touched block filled in
+
+    BlockDirectoryEntry(int csn_ref, uint64_t touched_ref)
+        : csn(csn_ref), touched(touched_ref), published(false) {}
+};
+
+/**
+ * The block versions reserved for one commit.
+ */
+struct BlockReservation {
+    struct Slot {
+        int block;
+        BitmapRef *ref;
+        CompressedBitmap *bitmap;
+    };
+    BlockDirectoryEntry *entry = nullptr;
+    std::vector<Slot> slots;
+};
+
+/**
+ * Snapshot of block-partition counters.
+ */
+struct BlockPartitionStats {
+    int blocks = 0;                                       // Blocks the bitmap is split into
+    int live_blocks = 0;                                  // Blocks with at least one version
+    size_t directory_entries = 0;                         // Committed CSNs still readable
+    uint64_t directory_pruned = 0;                        // Entries removed by GC
+    uint64_t block_versions = 0;                          // Versions summed over all blocks
+    size_t memory_bytes = 0;                              // Block controllers plus directory
+
+    void print(std::ostream &os) const {
+        os << "block partition: " << live_blocks << "/" << blocks << " blocks live, "
+           << block_versions << " block versions for " << directory_entries
+           << " CSNs (" << directory_pruned << " pruned), memory " << memory_bytes << " bytes"
+           << std::endl;
+    }
+};
+
+/**
+ * Block-partitioned bitmap versioning.
+ *
+ * The bitmap is split into fixed blocks of block_rows rows.  Each block
+ * is versioned independently by its own BitmapController, created the
+ * first time the block changes, so a commit only adds versions to the
+ * blocks it touches.  A block that never changed reads as zeros.  The
+ * cross-block directory records which blocks each CSN touched and
+ * whether the CSN is fully published.  collect_garbage runs every
+ * block's GC and drops the directory entries it left unreadable.
+ *
+ * Like BitmapController, insert_null must be called in CSN order and
+ * insert_bitmap_content may then run concurrently.
+ */
+class BlockPartitionedController {
+  public:
+    BlockPartitionedController(std::vector<int> &tsn_list_ref,
+                               const BlockPartitionConfig &config_ref = BlockPartitionConfig())
+        : tsn_list(tsn_list_ref), config(config_ref) {
+        int total_rows = BITMAP_SIZE * 8;
+        config.block_rows = std::max(8, config.block_rows / 8 * 8);
+        while ((total_rows + config.block_rows - 1) / config.block_rows > MAX_BLOCKS) {
+            config.block_rows *= 2;
+        }
+        config.block_config.pipelined_commit = false;
+        config.block_config.gc_interval_ms = 0;
+        block_bytes = config.block_rows / 8;
+        block_num = (BITMAP_SIZE + block_bytes - 1) / block_bytes;
+        for (int b = 0; b < block_num; b++) {
+            blocks[b].store(nullptr);
+            first_csn[b].store(INT_MAX);
+        }
+        latest = new uint8_t[BITMAP_SIZE]();
+    }
+
+    ~BlockPartitionedController() {
+        for (int b = 0; b < block_num; b++) {
+            delete blocks[b].load();
+        }
+        delete[] latest;
+    }
+
+    /**
+     * Stage 1: reserve a version in every block that differs from the
+     * previous commit and record the CSN in the directory.
+     */
+    bool insert_null(int csn, uint8_t *original_bitmap, BlockReservation &reservation) {
+        std::lock_guard<std::mutex> lk(reserve_lock);
+        uint64_t touched = 0;
+        reservation.slots.clear();
+        for (int b = 0; b < block_num; b++) {
+            int offset = b * block_bytes;
+            int len = block_len(b);
+            if (memcmp(latest + offset, original_bitmap + offset, len) == 0) continue;
+            memcpy(latest + offset, original_bitmap + offset, len);
+            touched |= 1ull << b;
+
+            BitmapController *block = blocks[b].load();
+            if (block == nullptr) {
+                block = new BitmapController(tsn_list, config.block_config);
+                blocks[b].store(block, std::memory_order_release);
+                first_csn[b].store(csn, std::memory_order_release);
+            }
+            BlockReservation::Slot slot = {b, nullptr, nullptr};
+            block->insert_null(csn, original_bitmap + offset, slot.ref, slot.bitmap, len);
+            if (slot.ref != nullptr) reservation.slots.push_back(slot);
+        }
+
+        std::lock_guard<SiteLock<std::shared_mutex>> dir_lk(directory_lock);
+        directory.push_back(std::unique_ptr<BlockDirectoryEntry>(
+            new BlockDirectoryEntry(csn, touched)));
+        reservation.entry = directory.back().get();
+        if (reservation.slots.empty()) reservation.entry->published.store(true);
+        return true;
+    }
+
+    /**
+     * Stage 2: fill the reserved block versions and publish the CSN.
+     */
+    bool insert_bitmap_content(BlockReservation &reservation, uint8_t *original_bitmap) {
+        for (const BlockReservation::Slot &slot : reservation.slots) {
+            int offset = slot.block * block_bytes;
+            blocks[slot.block].load()->insert_bitmap_content(
+                slot.ref, slot.bitmap, original_bitmap + offset, block_len(slot.block));
+        }
+        reservation.entry->published.store(true, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Reconstruct the full bitmap of a published CSN.
+     */
+    bool get_bitmap(int csn, uint8_t *bitmap_result) {
+        return get_bitmap_range(csn, 0, BITMAP_SIZE, bitmap_result);
+    }
+
+    /**
+     * Reconstruct bytes [first_byte, first_byte + byte_cnt) of a published
+     * CSN, i.e. rows [8 * first_byte, 8 * (first_byte + byte_cnt)).
+     * Only the blocks overlapping the range are read.
+     */
+    bool get_bitmap_range(int csn, int first_byte, int byte_cnt, uint8_t *bitmap_result) {
+        if (first_byte < 0 || byte_cnt < 0 || first_byte + byte_cnt > BITMAP_SIZE) return false;
+        if (!is_published(csn)) return false;
+        if (byte_cnt == 0) return true;
+
+        std::vector<uint8_t> block_buf(block_bytes);
+        int end_byte = first_byte + byte_cnt;
+        for (int b = first_byte / block_bytes; b * block_bytes < end_byte; b++) {
+            int offset = b * block_bytes;
+            int from = std::max(first_byte, offset);
+            int to = std::min(end_byte, offset + block_len(b));
+            uint8_t *dst = bitmap_result + (from - first_byte);
+            if (csn < first_csn[b].load(std::memory_order_acquire)) {
+                memset(dst, 0, to - from);
+                continue;
+            }
+            int len = 0;
+            if (!blocks[b].load(std::memory_order_acquire)->get_bitmap_as_of(
+                    csn, block_buf.data(), &len)) {
+                return false;
+            }
+            memcpy(dst, block_buf.data() + (from - offset), to - from);
+        }
+        return true;
+    }
+
+    /**
+     * Run GC on every block and prune the directory.  A CSN reads, in
+     * each block, the newest version that touched the block at or before
+     * it.  Blocks therefore pin the versions active_snapshots resolve to,
+     * and a published entry is dropped once a version it resolves to is
+     * gone, as its reads would no longer be correct.  The newest entry
+     * is always kept.  Returns the bytes freed.
+     */
+    size_t collect_garbage(int64_t now_us, std::vector<int> active_snapshots) {
+        std::lock_guard<std::mutex> gc_guard(gc_lock);
+        std::sort(active_snapshots.begin(), active_snapshots.end());
+        struct EntryView {
+            int csn;
+            uint64_t touched;
+            bool published;
+        };
+        std::vector<EntryView> entries;
+        {
+            std::shared_lock<SiteLock<std::shared_mutex>> lk(directory_lock);
+            entries.reserve(directory.size());
+            for (const auto &entry : directory) {
+                entries.push_back({entry->csn, entry->touched,
+                                   entry->published.load(std::memory_order_acquire)});
+            }
+        }
+        if (entries.empty()) return 0;
+
+        // Block versions the active snapshots resolve to.
+        std::vector<std::vector<int>> pins(block_num);
+        int last_touch[MAX_BLOCKS];
+        std::fill(last_touch, last_touch + MAX_BLOCKS, -1);
+        size_t s = 0;
+        auto pin_snapshot = [&] {
+            for (int b = 0; b < block_num; b++) {
+                if (last_touch[b] >= 0) pins[b].push_back(last_touch[b]);
+            }
+            s++;
+        };
+        for (const EntryView &e : entries) {
+            while (s < active_snapshots.size() && active_snapshots[s] < e.csn) pin_snapshot();
+            for (uint64_t m = e.touched; m != 0; m &= m - 1) last_touch[__builtin_ctzll(m)] = e.csn;
+        }
+        while (s < active_snapshots.size()) pin_snapshot();
+
+        size_t freed = 0;
+        std::vector<std::vector<int>> retained(block_num);
+        for (int b = 0; b < block_num; b++) {
+            BitmapController *block = blocks[b].load();
+            if (block == nullptr) continue;
+            freed += block->collect_garbage(now_us, pins[b]);
+            retained[b] = block->get_retained_csns();
+        }
+
+        // Walk the entries in CSN order, tracking the blocks whose
+        // resolved version was dropped.
+        std::vector<int> dropped;
+        uint64_t missing = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            const EntryView &e = entries[i];
+            for (uint64_t m = e.touched; m != 0; m &= m - 1) {
+                int b = __builtin_ctzll(m);
+                bool kept = !e.published ||
+                            std::binary_search(retained[b].begin(), retained[b].end(), e.csn);
+                missing = kept ? missing & ~(1ull << b) : missing | (1ull << b);
+            }
+            if (missing != 0 && e.published && i + 1 < entries.size()) dropped.push_back(e.csn);
+        }
+        if (dropped.empty()) return freed;
+
+        std::lock_guard<SiteLock<std::shared_mutex>> lk(directory_lock);
+        std::deque<std::unique_ptr<BlockDirectoryEntry>> kept;
+        size_t d = 0;
+        for (auto &entry : directory) {
+            while (d < dropped.size() && dropped[d] < entry->csn) d++;
+            if (d < dropped.size() && dropped[d] == entry->csn) continue;
+            kept.push_back(std::move(entry));
+        }
+        directory.swap(kept);
+        directory_pruned += dropped.size();
+        return freed + dropped.size() * (sizeof(BlockDirectoryEntry) +
+                                         sizeof(std::unique_ptr<BlockDirectoryEntry>));
+    }
+
+    BlockPartitionStats get_stats() const {
+        BlockPartitionStats stats;
+        stats.blocks = block_num;
+        for (int b = 0; b < block_num; b++) {
+            BitmapController *block = blocks[b].load();
+            if (block == nullptr) continue;
+            stats.live_blocks++;
+            stats.memory_bytes += block->get_stats().memory_bytes;
+        }
+        std::shared_lock<SiteLock<std::shared_mutex>> lk(directory_lock);
+        stats.directory_entries = directory.size();
+        stats.directory_pruned = directory_pruned;
+        for (const auto &entry : directory) {
+            stats.block_versions += __builtin_popcountll(entry->touched);
+        }
+        stats.memory_bytes += directory.size() * (sizeof(BlockDirectoryEntry) +
+                                                 sizeof(std::unique_ptr<BlockDirectoryEntry>)) +
+                              BITMAP_SIZE;
+        return stats;
+    }
+
+    int get_block_bytes() const { return block_bytes; }
+
+    int get_block_num() const { return block_num; }
+
+  private:
+    std::vector<int> &tsn_list;
+    BlockPartitionConfig config;
+    int block_bytes;
+    int block_num;
+    std::atomic<BitmapController*> blocks[MAX_BLOCKS];    // Created on first change
+    std::atomic<int> first_csn[MAX_BLOCKS];                // CSN of a block's first version
+    uint8_t *latest;                                       // Newest reserved bitmap
+    std::mutex reserve_lock;                               // Serializes insert_null
+
+    // CSN order; entries are heap allocated so reservations keep their
+    // pointer while GC removes others.
+    std::deque<std::unique_ptr<BlockDirectoryEntry>> directory;
+    mutable SiteLock<std::shared_mutex> directory_lock{"block_directory_lock"};
+    uint64_t directory_pruned = 0;                         // Guarded by directory_lock
+    std::mutex gc_lock;                                    // One GC pass at a time
+
+    int block_len(int b) const {
+        return std::min(block_bytes, BITMAP_SIZE - b * block_bytes);
+    }
+
+    bool is_published(int csn) const {
+        std::shared_lock<SiteLock<std::shared_mutex>> lk(directory_lock);
+        auto it = std::lower_bound(directory.begin(), directory.end(), csn,
+                                   [](const std::unique_ptr<BlockDirectoryEntry> &e, int c) {
+                                       return e->csn < c;
+                                   });
+        return it != directory.end() && (*it)->csn == csn &&
+               (*it)->published.load(std::memory_order_acquire);
+    }
+};
+
+#endif // BLOCK_PARTITIONED_CONTROLLER_H
@@ -0,0 +1,519 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "HierDiffController.h"
+
+/**
+ * Settings of a checkpoint chain.
+ */
+struct CheckpointConfig {
+    std::string dir = "checkpoint";                       // Directory holding the segment files
+    int max_segments = 4;                                 // Chain length that triggers a merge
+    bool background_merge = true;                         // Merge on a thread instead of inline
+};
+
+/**
+ * Counters of a checkpoint chain at one point in time.
+ */
+struct CheckpointStats {
+    uint64_t checkpoints = 0;                             // Segments appended by checkpoint()
+    uint64_t groups_written = 0;                          // New or changed groups appended
+    uint64_t groups_reused = 0;                           // Unchanged groups left where they were
+    uint64_t bytes_written = 0;                           // Group and directory bytes appended
+    uint64_t merges = 0;                                  // Merges run
+    uint64_t merge_bytes = 0;                             // Group bytes rewritten by merges
+    size_t segments = 0;                                  // Current chain length
+    size_t image_bytes = 0;                               // Group bytes of the current image
+    size_t chain_bytes = 0;                               // Group bytes of every segment
+
+    void print(std::ostream &os) const {
+        if (checkpoints == 0) return;
+        os << "checkpoints: " << checkpoints << " (" << groups_written << " groups written, "
+           << groups_reused << " reused, " << bytes_written << " bytes), " << merges
+           << " merges (" << merge_bytes << " bytes), chain " << segments << " segments, "
+           << chain_bytes << " bytes for a " << image_bytes << " byte image" << std::endl;
+    }
+};
+
+/**
+ * Incremental checkpoints of a BitmapController as a chain of segment
+ * files.
+ *
+ * A checkpoint appends one segment holding only the groups whose
+ * fingerprint changed since the previous checkpoint, usually the head
+ * group, followed by the directory of the whole image: for every group,
+ * the segment and byte range of its newest image.  The segment with the
+ * highest sequence number is authoritative; older segments only keep
+ * group images its directory points at.  Groups are stored as the log
+ * records of BitmapController::export_groups and restored with
+ * replay_log_record.
+ *
+ * Once the chain is longer than max_segments, a merge copies the live
+ * groups of the newer segments into a single new segment.  Older
+ * segments that are mostly live and larger than everything merged with
+ * them are kept, as in size-tiered compaction, so a group image is
+ * rewritten a logarithmic number of times and merge I/O follows the
+ * checkpoint write rate rather than the image size.
+ *
+ * Segments are written to a temporary file, synced and renamed into
+ * place; files are in native byte order.  Checkpoints are serialized
+ * with each other and may run concurrently with a merge.
+ */
+class CheckpointChain {
+  public:
+    explicit CheckpointChain(const CheckpointConfig &config_ref = CheckpointConfig())
+        : config(config_ref) {
+        std::filesystem::create_directories(config.dir);
+        open_chain();
+        if (config.background_merge) {
+            merger = std::thread([this] { merge_loop(); });
+        }
+    }
+
+    ~CheckpointChain() {
+        if (merger.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(dir_lock);
+                stopping = true;
+            }
+            merge_cv.notify_all();
+            merger.join();
+        }
+    }
+
+    CheckpointChain(const CheckpointChain &) = delete;
+    CheckpointChain &operator=(const CheckpointChain &) = delete;
+
+    /**
+     * Append a segment with the groups of controller that changed since
+     * the last checkpoint.  Returns false if the segment could not be
+     * written; the chain is then unchanged.
+     */
+    bool checkpoint(BitmapController &controller) {
+        std::lock_guard<std::mutex> ck(checkpoint_lock);
+        std::unordered_map<int, uint64_t> previous;
+        {
+            std::lock_guard<std::mutex> lk(dir_lock);
+            for (const DirectoryEntry &entry : directory) {
+                previous[entry.group_csn] = entry.fingerprint;
+            }
+        }
+
+        std::vector<uint8_t> data;
+        std::unordered_map<int, std::pair<uint64_t, uint64_t>> written;
+        int open_group = 0;
+        std::vector<GroupFingerprint> groups = controller.export_groups(
+            [&](const GroupFingerprint &group) {
+                auto it = previous.find(group.group_csn);
+                if (it != previous.end() && it->second == group.fingerprint) return false;
+                open_group = group.group_csn;
+                written[open_group] = {data.size(), 0};
+                return true;
+            },
+            [&](const DiffLogRecord &record) {
+                append(data, &record.header, sizeof(record.header));
+                append(data, record.payload, record.header.payload_bytes);
+                written[open_group].second = data.size() - written[open_group].first;
+            });
+        if (written.empty() && groups.size() == previous.size()) return true;
+
+        std::string tmp = tmp_path("checkpoint");
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        if (!write_fully(fd, data.data(), data.size())) {
+            ::close(fd);
+            std::remove(tmp.c_str());
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lk(dir_lock);
+        uint64_t seq = next_seq++;
+        std::unordered_map<int, const DirectoryEntry *> current;
+        for (const DirectoryEntry &entry : directory) current[entry.group_csn] = &entry;
+        std::vector<DirectoryEntry> next;
+        next.reserve(groups.size());
+        uint64_t reused = 0;
+        for (const GroupFingerprint &group : groups) {
+            DirectoryEntry entry;
+            auto w = written.find(group.group_csn);
+            if (w != written.end()) {
+                entry.group_csn = group.group_csn;
+                entry.published_csn = group.published_csn;
+                entry.fingerprint = group.fingerprint;
+                entry.segment = seq;
+                entry.offset = w->second.first;
+                entry.bytes = w->second.second;
+            } else {
+                // Unchanged since the snapshot; a merge may have moved it.
+                entry = *current.at(group.group_csn);
+                reused++;
+            }
+            next.push_back(entry);
+        }
+        if (!finish_segment(fd, tmp, seq, data.size(), next)) return false;
+
+        directory.swap(next);
+        segment_bytes[seq] = data.size();
+        stats.checkpoints++;
+        stats.groups_written += written.size();
+        stats.groups_reused += reused;
+        stats.bytes_written += data.size() + directory.size() * sizeof(DirectoryEntry) +
+                               sizeof(SegmentFooter);
+        if ((int)segment_bytes.size() > config.max_segments) {
+            if (config.background_merge) {
+                merge_cv.notify_all();
+            } else {
+                lk.unlock();
+                merge();
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Rebuild the latest checkpoint into an empty controller, which is
+     * then ready for commits.  Returns false if a segment is missing or
+     * damaged.
+     */
+    bool restore(BitmapController &controller) {
+        std::lock_guard<std::mutex> mk(merge_lock);
+        std::vector<DirectoryEntry> image;
+        {
+            std::lock_guard<std::mutex> lk(dir_lock);
+            image = directory;
+        }
+        std::vector<uint8_t> data;
+        for (auto it = image.rbegin(); it != image.rend(); ++it) {
+            data.resize(it->bytes);
+            if (!read_range(it->segment, it->offset, data.data(), data.size())) return false;
+            size_t pos = 0;
+            while (pos + sizeof(DiffLogHeader) <= data.size()) {
+                DiffLogRecord record;
+                memcpy(&record.header, data.data() + pos, sizeof(record.header));
+                pos += sizeof(record.header);
+                if (pos + record.header.payload_bytes > data.size()) return false;
+                record.payload = data.data() + pos;
+                pos += record.header.payload_bytes;
+                if (!controller.replay_log_record(record)) return false;
+            }
+        }
+        controller.resume_commits();
+        return true;
+    }
+
+    /**
+     * Merge the chain now, unless it has a single segment.
+     */
+    void merge() {
+        std::lock_guard<std::mutex> mk(merge_lock);
+        merge_segments();
+    }
+
+    /**
+     * Block until a background merge has brought the chain back within
+     * max_segments.
+     */
+    void wait_for_merge() {
+        std::unique_lock<std::mutex> lk(dir_lock);
+        merge_done_cv.wait(lk, [this] {
+            return !merging && (int)segment_bytes.size() <= config.max_segments;
+        });
+    }
+
+    CheckpointStats get_stats() {
+        std::lock_guard<std::mutex> lk(dir_lock);
+        CheckpointStats out = stats;
+        out.segments = segment_bytes.size();
+        for (const DirectoryEntry &entry : directory) out.image_bytes += entry.bytes;
+        for (const auto &segment : segment_bytes) out.chain_bytes += segment.second;
+        return out;
+    }
+
+  private:
+    /**
+     * Location of one group's newest image.
+     */
+    struct DirectoryEntry {
+        int32_t group_csn = 0;
+        int32_t published_csn = 0;
+        uint64_t fingerprint = 0;
+        uint64_t segment = 0;                             // Sequence number of the segment file
+        uint64_t offset = 0;                              // Byte offset of the group's records
+        uint64_t bytes = 0;
+    };
+
+    /**
+     * Last bytes of a segment file: group data, then the directory, then
+     * this footer.
+     */
+    struct SegmentFooter {
+        uint64_t seq = 0;
+        uint64_t directory_offset = 0;                    // Also the group data size
+        uint32_t directory_count = 0;
+        uint32_t magic = SEGMENT_MAGIC;
+    };
+
+    static const uint32_t SEGMENT_MAGIC = 0x48444350;     // "HDCP"
+
+    CheckpointConfig config;
+    std::mutex checkpoint_lock;                           // One checkpoint at a time
+    std::mutex merge_lock;                                // One merge or restore at a time
+    std::mutex dir_lock;                                  // Guards everything below
+    std::vector<DirectoryEntry> directory;                // Latest image, newest group first
+    std::map<uint64_t, uint64_t> segment_bytes;           // Live segments and their group data size
+    uint64_t next_seq = 1;
+    int tmp_files = 0;
+    bool merging = false;
+    bool stopping = false;
+    CheckpointStats stats;
+    std::condition_variable merge_cv;
+    std::condition_variable merge_done_cv;
+    std::thread merger;
+
+    std::string segment_path(uint64_t seq) const {
+        char name[32];
+        snprintf(name, sizeof(name), "segment_%010llu.ckpt", (unsigned long long)seq);
+        return config.dir + "/" + name;
+    }
+
+    std::string tmp_path(const char *kind) {
+        std::lock_guard<std::mutex> lk(dir_lock);
+        return config.dir + "/" + kind + "_" + std::to_string(tmp_files++) + ".tmp";
+    }
+
+    static void append(std::vector<uint8_t> &data, const void *src, size_t len) {
+        const uint8_t *p = static_cast<const uint8_t *>(src);
+        data.insert(data.end(), p, p + len);
+    }
+
+    static bool write_fully(int fd, const void *buf, size_t len) {
+        const uint8_t *p = static_cast<const uint8_t *>(buf);
+        while (len > 0) {
+            ssize_t n = ::write(fd, p, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    static bool read_fully(int fd, void *buf, size_t len, off_t offset) {
+        uint8_t *p = static_cast<uint8_t *>(buf);
+        while (len > 0) {
+            ssize_t n = ::pread(fd, p, len, offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    bool read_range(uint64_t seq, uint64_t offset, uint8_t *buf, size_t len) const {
+        int fd = ::open(segment_path(seq).c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        bool ok = read_fully(fd, buf, len, (off_t)offset);
+        ::close(fd);
+        return ok;
+    }
+
+    /**
+     * Append the directory and footer to a segment whose group data is
+     * written, sync it and move it into place.  Called under dir_lock, so
+     * segments become visible in sequence order.
+     */
+    bool finish_segment(int fd, const std::string &tmp, uint64_t seq, uint64_t data_bytes,
+                        const std::vector<DirectoryEntry> &entries) {
+        SegmentFooter footer;
+        footer.seq = seq;
+        footer.directory_offset = data_bytes;
+        footer.directory_count = (uint32_t)entries.size();
+        bool ok = write_fully(fd, entries.data(), entries.size() * sizeof(DirectoryEntry)) &&
+                  write_fully(fd, &footer, sizeof(footer)) && ::fsync(fd) == 0;
+        ::close(fd);
+        if (ok) ok = std::rename(tmp.c_str(), segment_path(seq).c_str()) == 0;
+        if (!ok) {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        int dir_fd = ::open(config.dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dir_fd >= 0) {
+            ::fsync(dir_fd);
+            ::close(dir_fd);
+        }
+        return true;
+    }
+
+    /**
+     * Read the footer and directory of a segment file.
+     */
+    bool read_segment(const std::string &path, SegmentFooter &footer,
+                      std::vector<DirectoryEntry> &entries) const {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        off_t size = ::lseek(fd, 0, SEEK_END);
+        bool ok = size >= (off_t)sizeof(footer) &&
+                  read_fully(fd, &footer, sizeof(footer), size - (off_t)sizeof(footer)) &&
+                  footer.magic == SEGMENT_MAGIC &&
+                  footer.directory_offset + (uint64_t)footer.directory_count * sizeof(DirectoryEntry) +
+                  sizeof(footer) == (uint64_t)size;
+        if (ok) {
+            entries.resize(footer.directory_count);
+            ok = read_fully(fd, entries.data(), entries.size() * sizeof(DirectoryEntry),
+                            (off_t)footer.directory_offset);
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    /**
+     * Adopt the newest complete segment in the directory and delete
+     * files it does not reference: temporaries and segments superseded
+     * by a merge that did not get to remove them.
+     */
+    void open_chain() {
+        std::vector<std::pair<uint64_t, std::string>> found;
+        for (const auto &file : std::filesystem::directory_iterator(config.dir)) {
+            std::string name = file.path().filename().string();
+            unsigned long long seq = 0;
+            if (file.path().extension() == ".tmp") {
+                std::filesystem::remove(file.path());
+            } else if (sscanf(name.c_str(), "segment_%llu.ckpt", &seq) == 1) {
+                found.emplace_back(seq, file.path().string());
+            }
+        }
+        std::sort(found.rbegin(), found.rend());
+        for (const auto &candidate : found) {
+            SegmentFooter footer;
+            std::vector<DirectoryEntry> entries;
+            if (!read_segment(candidate.second, footer, entries)) continue;
+            directory = entries;
+            segment_bytes[candidate.first] = footer.directory_offset;
+            for (const DirectoryEntry &entry : directory) {
+                if (segment_bytes.count(entry.segment)) continue;
+                SegmentFooter other;
+                std::vector<DirectoryEntry> unused;
+                if (read_segment(segment_path(entry.segment), other, unused)) {
+                    segment_bytes[entry.segment] = other.directory_offset;
+                }
+            }
+            break;
+        }
+        for (const auto &candidate : found) {
+            next_seq = std::max<uint64_t>(next_seq, candidate.first + 1);
+            if (!segment_bytes.count(candidate.first)) std::filesystem::remove(candidate.second);
+        }
+    }
+
+    void merge_loop() {
+        std::unique_lock<std::mutex> lk(dir_lock);
+        while (true) {
+            merge_cv.wait(lk, [this] {
+                return stopping || (int)segment_bytes.size() > config.max_segments;
+            });
+            if (stopping) return;
+            lk.unlock();
+            merge();
+            lk.lock();
+        }
+    }
+
+    /**
+     * Copy the live groups of the merged segments into one new segment,
+     * publish it with the current directory and delete the merged files.
+     * Group records are copied verbatim.  Called under merge_lock.
+     */
+    void merge_segments() {
+        std::vector<DirectoryEntry> image;
+        std::vector<uint64_t> victims;
+        {
+            std::lock_guard<std::mutex> lk(dir_lock);
+            if (segment_bytes.size() <= 1) return;
+            merging = true;
+            image = directory;
+            std::map<uint64_t, uint64_t> live;
+            for (const DirectoryEntry &entry : image) live[entry.segment] += entry.bytes;
+            // Newest first: keep a segment that is mostly live and larger
+            // than everything merged so far, but never more than the
+            // chain can hold next to the merged segment.
+            std::vector<uint64_t> kept;
+            uint64_t merged_live = 0;
+            for (auto it = segment_bytes.rbegin(); it != segment_bytes.rend(); ++it) {
+                uint64_t seg_live = live[it->first];
+                if (victims.size() >= 2 && seg_live * 2 >= it->second && seg_live > merged_live) {
+                    kept.push_back(it->first);
+                } else {
+                    victims.push_back(it->first);
+                    merged_live += seg_live;
+                }
+            }
+            size_t max_kept = (size_t)std::max(config.max_segments - 1, 0);
+            for (size_t i = 0; kept.size() - i > max_kept; i++) victims.push_back(kept[i]);
+        }
+
+        std::string tmp = tmp_path("merge");
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0;
+        std::map<std::pair<uint64_t, uint64_t>, uint64_t> moved;   // (segment, offset) -> new offset
+        uint64_t data_bytes = 0;
+        std::vector<uint8_t> buf;
+        for (const DirectoryEntry &entry : image) {
+            if (!ok) break;
+            if (std::find(victims.begin(), victims.end(), entry.segment) == victims.end()) continue;
+            buf.resize(entry.bytes);
+            ok = read_range(entry.segment, entry.offset, buf.data(), buf.size()) &&
+                 write_fully(fd, buf.data(), buf.size());
+            moved[{entry.segment, entry.offset}] = data_bytes;
+            data_bytes += entry.bytes;
+        }
+
+        std::unique_lock<std::mutex> lk(dir_lock);
+        if (ok) {
+            uint64_t seq = next_seq++;
+            std::vector<DirectoryEntry> next = directory;
+            for (DirectoryEntry &entry : next) {
+                auto it = moved.find({entry.segment, entry.offset});
+                if (it == moved.end()) continue;
+                entry.segment = seq;
+                entry.offset = it->second;
+            }
+            ok = finish_segment(fd, tmp, seq, data_bytes, next);
+            if (ok) {
+                directory.swap(next);
+                for (uint64_t victim : victims) {
+                    segment_bytes.erase(victim);
+                    std::remove(segment_path(victim).c_str());
+                }
+                segment_bytes[seq] = data_bytes;
+                stats.merges++;
+                stats.merge_bytes += data_bytes;
+            }
+        } else if (fd >= 0) {
+            ::close(fd);
+            std::remove(tmp.c_str());
+        }
+        merging = false;
+        lk.unlock();
+        merge_done_cv.notify_all();
+    }
+};
+
+#endif // CHECKPOINT_H
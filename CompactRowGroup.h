@@ -0,0 +1,300 @@
+#ifndef COMPACT_ROW_GROUP_H
+#define COMPACT_ROW_GROUP_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "HierDiffController.h"
+
+/**
+ * Settings shared by every row group of a table.  Held once by the
+ * table, not by the row groups.
+ */
+struct RowGroupContext {
+    std::vector<int> &tsn_list;                           // Passed to upgraded controllers
+    ControllerConfig config;
+
+    explicit RowGroupContext(std::vector<int> &tsn_list_ref,
+                             const ControllerConfig &config_ref = ControllerConfig())
+        : tsn_list(tsn_list_ref), config(config_ref) {}
+};
+
+/**
+ * The only version of a row group that was never updated after load.
+ */
+struct SingleVersion {
+    int csn;
+    int bitmap_len;
+    uint8_t bitmap[1];                                    // bitmap_len bytes
+
+    static SingleVersion *create(int csn, const uint8_t *bitmap, int bitmap_len) {
+        void *mem = ::operator new(sizeof(SingleVersion) + bitmap_len);
+        SingleVersion *single = static_cast<SingleVersion *>(mem);
+        single->csn = csn;
+        single->bitmap_len = bitmap_len;
+        memcpy(single->bitmap, bitmap, bitmap_len);
+        return single;
+    }
+
+    static void destroy(SingleVersion *single) {
+        ::operator delete(single);
+    }
+
+    size_t bytes() const {
+        return sizeof(SingleVersion) + bitmap_len;
+    }
+};
+
+/**
+ * Layout of CompactRowGroup::word.
+ * Bits 0-1 hold the state.  A uniform state keeps the logical length in
+ * bits 2-14 and the load CSN in bits 16-47; the other states keep a
+ * pointer, which is at least 8-byte aligned.
+ */
+enum RowGroupState : uintptr_t {
+    ROW_GROUP_ZEROS = 0,                                  // Every bit clear
+    ROW_GROUP_ONES = 1,                                   // Every bit set
+    ROW_GROUP_SINGLE = 2,                                 // SingleVersion *
+    ROW_GROUP_FULL = 3                                    // BitmapController *
+};
+
+const uintptr_t ROW_GROUP_STATE_MASK = 3;
+const int ROW_GROUP_LENGTH_SHIFT = 2;
+const int ROW_GROUP_CSN_SHIFT = 16;
+
+/**
+ * Bitmap versions of one row group in a single word.
+ *
+ * A row group that was loaded once and never updated is stored as its
+ * uniform state (all zeros or all ones, no allocation at all) or as one
+ * immutable bitmap.  The first insert that changes the content upgrades
+ * it to a full BitmapController seeded with the loaded version; inserts
+ * that leave the content unchanged keep it compact, as every snapshot
+ * from the load CSN on still reads the same bitmap.
+ *
+ * Inserts must be serialized per row group, in CSN order, like
+ * BitmapController::insert_null.  Reads are lock-free; a replaced single
+ * version is retired through a reclaimer shared by all row groups.
+ */
+class CompactRowGroup {
+  public:
+    /**
+     * An all-zeros row group loaded at csn.
+     */
+    explicit CompactRowGroup(int csn = 0, int bitmap_len = BITMAP_SIZE)
+        : word(uniform_word(ROW_GROUP_ZEROS, csn, bitmap_len)) {}
+
+    ~CompactRowGroup() {
+        release(word.load());
+    }
+
+    CompactRowGroup(const CompactRowGroup &) = delete;
+    CompactRowGroup &operator=(const CompactRowGroup &) = delete;
+
+    /**
+     * Move for container growth; neither side may be in use.
+     */
+    CompactRowGroup(CompactRowGroup &&other) noexcept : word(other.word.load()) {
+        other.word.store(uniform_word(ROW_GROUP_ZEROS, 0, 0));
+    }
+
+    /**
+     * Reset to the loaded bitmap of csn, stored uniformly when possible.
+     * Not concurrent with reads.
+     */
+    void load(int csn, const uint8_t *bitmap, int bitmap_len = BITMAP_SIZE) {
+        release(word.load());
+        word.store(compact_word(csn, bitmap, bitmap_len));
+    }
+
+    /**
+     * Add the version csn, newer than every version so far.  Upgrades to
+     * a full controller on the first change of content.
+     */
+    bool insert(int csn, uint8_t *bitmap, RowGroupContext &ctx,
+                int bitmap_len = BITMAP_SIZE) {
+        uintptr_t w = word.load();
+        if (state(w) == ROW_GROUP_FULL) {
+            return insert_full(controller(w), csn, bitmap, bitmap_len);
+        }
+        if (csn <= base_csn(w)) return false;
+        if (same_content(w, bitmap, bitmap_len)) return true;
+
+        std::vector<uint8_t> base(BITMAP_SIZE);
+        int base_len = materialize(w, base.data());
+        std::vector<BulkVersion> versions(2);
+        versions[0].csn = base_csn(w);
+        versions[0].bitmap = base.data();
+        versions[0].bitmap_len = base_len;
+        versions[1].csn = csn;
+        versions[1].bitmap = bitmap;
+        versions[1].bitmap_len = bitmap_len;
+        BitmapController *full = new BitmapController(ctx.tsn_list, ctx.config);
+        if (!full->bulk_load(versions)) {
+            delete full;
+            return false;
+        }
+        word.store(reinterpret_cast<uintptr_t>(full) | ROW_GROUP_FULL, std::memory_order_release);
+        if (state(w) == ROW_GROUP_SINGLE) {
+            SingleVersion *single = single_version(w);
+            reclaimer().retire([single] { SingleVersion::destroy(single); }, single->bytes());
+        }
+        return true;
+    }
+
+    /**
+     * Reconstruct the newest version with CSN <= require_csn, with the
+     * same length conventions as BitmapController::get_bitmap_as_of.
+     */
+    bool get_bitmap_as_of(int require_csn, uint8_t *bitmap_result, int *bitmap_len = nullptr) {
+        EpochGuard guard(reclaimer());
+        uintptr_t w = word.load(std::memory_order_acquire);
+        if (state(w) == ROW_GROUP_FULL) {
+            return controller(w)->get_bitmap_as_of(require_csn, bitmap_result, bitmap_len);
+        }
+        if (require_csn < base_csn(w)) return false;
+        int len = materialize(w, bitmap_result);
+        if (bitmap_len != nullptr) {
+            *bitmap_len = len;
+        } else if (len < BITMAP_SIZE) {
+            memset(bitmap_result + len, 0, BITMAP_SIZE - len);
+        }
+        return true;
+    }
+
+    bool is_compact() const {
+        return state(word.load()) != ROW_GROUP_FULL;
+    }
+
+    RowGroupState get_state() const {
+        return state(word.load());
+    }
+
+    /**
+     * The full controller, or nullptr while compact.
+     */
+    BitmapController *get_controller() const {
+        uintptr_t w = word.load(std::memory_order_acquire);
+        return state(w) == ROW_GROUP_FULL ? controller(w) : nullptr;
+    }
+
+    /**
+     * Bytes held by this row group, including the handle itself.
+     */
+    size_t memory_bytes() const {
+        uintptr_t w = word.load();
+        switch (state(w)) {
+        case ROW_GROUP_SINGLE:
+            return sizeof(*this) + single_version(w)->bytes();
+        case ROW_GROUP_FULL:
+            return sizeof(*this) + sizeof(BitmapController) +
+                   controller(w)->get_stats().memory_bytes;
+        default:
+            return sizeof(*this);
+        }
+    }
+
+    /**
+     * Free single versions retired by upgrades once no reader can see
+     * them.  Must not be called while reading a row group.
+     */
+    static size_t reclaim() {
+        return reclaimer().reclaim();
+    }
+
+  private:
+    std::atomic<uintptr_t> word;
+
+    static EpochReclaimer &reclaimer() {
+        static EpochReclaimer shared;
+        return shared;
+    }
+
+    static RowGroupState state(uintptr_t w) {
+        return static_cast<RowGroupState>(w & ROW_GROUP_STATE_MASK);
+    }
+
+    static uintptr_t uniform_word(RowGroupState s, int csn, int bitmap_len) {
+        return (uintptr_t)(uint32_t)csn << ROW_GROUP_CSN_SHIFT |
+               (uintptr_t)bitmap_len << ROW_GROUP_LENGTH_SHIFT | s;
+    }
+
+    static SingleVersion *single_version(uintptr_t w) {
+        return reinterpret_cast<SingleVersion *>(w & ~ROW_GROUP_STATE_MASK);
+    }
+
+    static BitmapController *controller(uintptr_t w) {
+        return reinterpret_cast<BitmapController *>(w & ~ROW_GROUP_STATE_MASK);
+    }
+
+    static int base_csn(uintptr_t w) {
+        if (state(w) == ROW_GROUP_SINGLE) return single_version(w)->csn;
+        return (int)(uint32_t)(w >> ROW_GROUP_CSN_SHIFT);
+    }
+
+    static int base_len(uintptr_t w) {
+        if (state(w) == ROW_GROUP_SINGLE) return single_version(w)->bitmap_len;
+        return (int)((w >> ROW_GROUP_LENGTH_SHIFT) & DIFF_LENGTH_MASK);
+    }
+
+    static uintptr_t compact_word(int csn, const uint8_t *bitmap, int bitmap_len) {
+        bool zeros = true;
+        bool ones = true;
+        for (int i = 0; i < bitmap_len && (zeros || ones); i++) {
+            zeros &= bitmap[i] == 0;
+            ones &= bitmap[i] == 0xFF;
+        }
+        if (zeros) return uniform_word(ROW_GROUP_ZEROS, csn, bitmap_len);
+        if (ones) return uniform_word(ROW_GROUP_ONES, csn, bitmap_len);
+        return reinterpret_cast<uintptr_t>(SingleVersion::create(csn, bitmap, bitmap_len)) |
+               ROW_GROUP_SINGLE;
+    }
+
+    /**
+     * Write the compact version of w; returns its length.
+     */
+    static int materialize(uintptr_t w, uint8_t *bitmap) {
+        int len = base_len(w);
+        switch (state(w)) {
+        case ROW_GROUP_ONES:
+            memset(bitmap, 0xFF, len);
+            break;
+        case ROW_GROUP_SINGLE:
+            memcpy(bitmap, single_version(w)->bitmap, len);
+            break;
+        default:
+            memset(bitmap, 0, len);
+            break;
+        }
+        return len;
+    }
+
+    static bool same_content(uintptr_t w, const uint8_t *bitmap, int bitmap_len) {
+        if (bitmap_len != base_len(w)) return false;
+        if (state(w) == ROW_GROUP_SINGLE) {
+            return memcmp(bitmap, single_version(w)->bitmap, bitmap_len) == 0;
+        }
+        uint8_t fill = state(w) == ROW_GROUP_ONES ? 0xFF : 0;
+        for (int i = 0; i < bitmap_len; i++) {
+            if (bitmap[i] != fill) return false;
+        }
+        return true;
+    }
+
+    static bool insert_full(BitmapController *full, int csn, uint8_t *bitmap, int bitmap_len) {
+        BitmapRef *ref = nullptr;
+        CompressedBitmap *node = nullptr;
+        if (!full->insert_null(csn, bitmap, ref, node, bitmap_len)) return false;
+        if (ref != nullptr) full->insert_bitmap_content(ref, node, bitmap, bitmap_len);
+        return true;
+    }
+
+    static void release(uintptr_t w) {
+        if (state(w) == ROW_GROUP_SINGLE) SingleVersion::destroy(single_version(w));
+        if (state(w) == ROW_GROUP_FULL) delete controller(w);
+    }
+};
+
+#endif // COMPACT_ROW_GROUP_H
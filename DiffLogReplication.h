@@ -0,0 +1,281 @@
+#ifndef DIFF_LOG_REPLICATION_H
+#define DIFF_LOG_REPLICATION_H
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HierDiffController.h"
+
+/**
+ * Local diff log shipping for HierDiff read replicas.
+ *
+ * A primary BitmapController streams its group boundaries and encoded
+ * diffs over a Unix stream socket.  A replica process replays them into
+ * its own BitmapController and ends up with an identical structure,
+ * without recompressing any version.
+ *
+ * Wire format: DiffLogHeader followed by header.payload_bytes bytes.
+ * Both sides run on the same machine, so native byte order is used.
+ */
+
+static bool write_all(int fd, const void *buf, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t *>(buf);
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len) {
+    uint8_t *p = static_cast<uint8_t *>(buf);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * Primary side: forwards every log record of a controller to the
+ * connected replicas.
+ *
+ * The log sink runs under the controller's locks, so publish() only
+ * copies the record into a queue; a sender thread writes it to the
+ * sockets.  The queue holds at most max_queued_bytes of payload: past
+ * that, publish() waits for the sender, so a replica that stops
+ * reading slows commits down instead of growing the queue.
+ */
+class DiffLogPublisher {
+  public:
+    explicit DiffLogPublisher(size_t max_queued_bytes_ref = 64 << 20)
+        : max_queued_bytes(max_queued_bytes_ref),
+          sender(&DiffLogPublisher::send_loop, this) {}
+
+    ~DiffLogPublisher() { close_all(); }
+
+    /**
+     * Start shipping to a connected replica socket.  Replicas must be
+     * added before the controller receives its first insert.
+     */
+    void add_replica(int fd) {
+        std::lock_guard<std::mutex> lk(send_lock);
+        replica_fds.push_back(fd);
+    }
+
+    void attach(BitmapController &controller) {
+        controller.set_log_sink([this](const DiffLogRecord &record) {
+            publish(record);
+        });
+    }
+
+    void publish(const DiffLogRecord &record) {
+        QueuedRecord queued;
+        queued.header = record.header;
+        const uint8_t *payload = static_cast<const uint8_t *>(record.payload);
+        queued.payload.assign(payload, payload + record.header.payload_bytes);
+        size_t bytes = sizeof(queued.header) + queued.payload.size();
+        {
+            std::unique_lock<std::mutex> lk(queue_lock);
+            if (queued_bytes + bytes > max_queued_bytes && !queue.empty()) {
+                publish_waits++;
+                space_cv.wait(lk, [&] {
+                    return stopping || queue.empty() || queued_bytes + bytes <= max_queued_bytes;
+                });
+            }
+            if (stopping) return;
+            queued_bytes += bytes;
+            queue.push_back(std::move(queued));
+        }
+        queue_cv.notify_one();
+    }
+
+    /**
+     * Announce the primary's high-water CSN and visible watermark so
+     * idle replicas can report their lag.  Every record of a CSN up to
+     * visible_csn must already have been published.
+     */
+    void heartbeat(int high_water_csn, int visible_csn) {
+        DiffLogRecord record;
+        record.header.type = LOG_HEARTBEAT;
+        record.header.csn = high_water_csn;
+        record.header.high_water_csn = high_water_csn;
+        record.header.visible_csn = visible_csn;
+        publish(record);
+    }
+
+    /**
+     * Send every queued record, then close all replica connections;
+     * replicas see end of stream.
+     */
+    void close_all() {
+        {
+            std::lock_guard<std::mutex> lk(queue_lock);
+            stopping = true;
+        }
+        queue_cv.notify_one();
+        space_cv.notify_all();
+        if (sender.joinable()) sender.join();
+        std::lock_guard<std::mutex> lk(send_lock);
+        for (int fd : replica_fds) close(fd);
+        replica_fds.clear();
+    }
+
+    uint64_t get_records_sent() const { return records_sent.load(); }
+
+    /**
+     * publish() calls that waited for queue space.
+     */
+    uint64_t get_publish_waits() {
+        std::lock_guard<std::mutex> lk(queue_lock);
+        return publish_waits;
+    }
+
+  private:
+    struct QueuedRecord {
+        DiffLogHeader header;
+        std::vector<uint8_t> payload;
+    };
+
+    void send_loop() {
+        std::unique_lock<std::mutex> qlk(queue_lock);
+        while (true) {
+            queue_cv.wait(qlk, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            QueuedRecord record = std::move(queue.front());
+            queue.pop_front();
+            qlk.unlock();
+            send_record(record);
+            qlk.lock();
+            queued_bytes -= sizeof(record.header) + record.payload.size();
+            space_cv.notify_all();
+        }
+    }
+
+    void send_record(const QueuedRecord &record) {
+        std::lock_guard<std::mutex> lk(send_lock);
+        for (size_t i = 0; i < replica_fds.size(); i++) {
+            if (!write_all(replica_fds[i], &record.header, sizeof(record.header)) ||
+                !write_all(replica_fds[i], record.payload.data(), record.payload.size())) {
+                close(replica_fds[i]);
+                replica_fds.erase(replica_fds.begin() + i);
+                i--;
+            }
+        }
+        records_sent++;
+    }
+
+    std::mutex send_lock;                                   // Guards replica_fds
+    std::vector<int> replica_fds;
+    std::mutex queue_lock;                                  // Guards the queue state below
+    std::condition_variable queue_cv;                       // Signals the sender
+    std::condition_variable space_cv;                       // Signals blocked publishers
+    std::deque<QueuedRecord> queue;                          // Records not yet sent
+    size_t queued_bytes = 0;                                // Including the record being sent
+    size_t max_queued_bytes;
+    uint64_t publish_waits = 0;
+    bool stopping = false;
+    std::atomic<uint64_t> records_sent{0};
+    std::thread sender;                                     // Declared last: starts in the constructor
+};
+
+/**
+ * Replica side: owns a BitmapController rebuilt from the primary's log.
+ */
+class DiffLogReplica {
+  public:
+    DiffLogReplica(int fd_ref, std::vector<int> &tsn_list_ref)
+        : fd(fd_ref), controller(tsn_list_ref) {}
+
+    ~DiffLogReplica() {
+        if (fd >= 0) close(fd);
+    }
+
+    /**
+     * Read and apply one record.  Returns false on end of stream, or
+     * when non-blocking and no record is pending.
+     */
+    bool apply_one(bool blocking) {
+        if (!blocking) {
+            pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 0) <= 0) return false;
+        }
+        DiffLogRecord record;
+        if (!read_all(fd, &record.header, sizeof(record.header))) return false;
+        payload.resize(record.header.payload_bytes);
+        if (record.header.payload_bytes > 0 &&
+            !read_all(fd, payload.data(), record.header.payload_bytes)) {
+            return false;
+        }
+        record.payload = payload.data();
+
+        primary_csn = std::max(primary_csn, record.header.high_water_csn);
+        if (record.header.type != LOG_HEARTBEAT) {
+            controller.replay_log_record(record);
+            records_applied++;
+        }
+        // Records of every CSN up to the stamp came earlier in the stream.
+        applied_csn = std::max(applied_csn, record.header.visible_csn);
+        return true;
+    }
+
+    /**
+     * Apply every record that is already available.
+     */
+    size_t apply_available() {
+        size_t n = 0;
+        while (apply_one(false)) n++;
+        return n;
+    }
+
+    /**
+     * Apply records until the primary closes the stream.
+     */
+    void run_until_eof() {
+        while (apply_one(true)) {}
+    }
+
+    BitmapController &get_controller() { return controller; }
+
+    /**
+     * Newest CSN such that every CSN up to it has been applied.  Versions
+     * published out of order may already be applied past it.
+     */
+    int get_applied_csn() const { return applied_csn; }
+
+    int get_primary_csn() const { return primary_csn; }
+
+    /**
+     * Replication lag in CSNs.
+     */
+    int get_lag_csn() const {
+        return std::max(0, primary_csn - get_applied_csn());
+    }
+
+    uint64_t get_records_applied() const { return records_applied; }
+
+  private:
+    int fd;
+    BitmapController controller;
+    std::vector<uint8_t> payload;
+    int primary_csn = -1;
+    int applied_csn = -1;                                  // Contiguous applied watermark
+    uint64_t records_applied = 0;
+};
+
+#endif // DIFF_LOG_REPLICATION_H
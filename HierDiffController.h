@@ -1,6 +1,7 @@
 #ifndef BITMAP_CONTROLLER_H
 #define BITMAP_CONTROLLER_H
 
+#include <algorithm>
 #include <assert.h>
 #include <cstdint>
 #include <mutex>
@@ -10,329 +11,3762 @@
 #include <atomic>
 #include <thread>
 #include <filesystem>
+#include <climits>
+#include <deque>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <bitset>
 #include <fstream>
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "LockProfiler.h"
+#include "QosScheduler.h"
+#include "ReferencePool.h"
+#include "TimeCsnIndex.h"
 
 const int BITMAP_SIZE = 7500;
 const int MAX_COMPRESS_NUM = 9;
+const int MAX_MATRIX_VERSIONS = 64;                      // One mask bit per version slot
+const int READ_HINT_MIN_HOPS = 4;                        // Groups skipped before a reader leaves a hint
+
+/**
+ * Encodings of a version's diff against its group reference.
+ */
+enum DiffEncoding : uint32_t {
+    ENC_SPARSE = 0,                                      // [n, positions...] of flipped bits, sorted
+    ENC_DENSE = 1,                                       // XOR image of (length + 1) / 2 words
+    ENC_RUNS = 2,                                        // [r, start, count, ...] runs of flipped bits
+    ENC_LOG = 3,                                         // [prefix lo, prefix hi] of the group's delete log
+    ENC_MATRIX = 4,                                      // [slot] column of the group's change matrix
+    ENC_PTREE = 5                                        // [root pointer] in the group's position tree
+};
+
+/**
+ * Layout of CompressedBitmap::tagged_diff.
+ * Bits 0-2 hold flags (diff arrays come from operator new[] and are at
+ * least 8-byte aligned), bits 3-47 the diff pointer (user-space
+ * addresses fit in 48 bits), bits 48-60 the logical bitmap length in
+ * bytes and bits 61-63 the DiffEncoding.
+ */
+const uintptr_t DIFF_READY = 1;                          // Content filled in
+const uintptr_t DIFF_DEAD = 2;                           // Unlinked, waiting to be reclaimed
+const uintptr_t DIFF_HOT = 4;                            // Decoded expensively once; cleared by set_diff
+const uintptr_t DIFF_FLAG_MASK = 7;
+const int DIFF_LENGTH_SHIFT = 48;
+const int DIFF_ENCODING_SHIFT = 61;
+const uintptr_t DIFF_LENGTH_MASK = 0x1fff;
+const uintptr_t DIFF_POINTER_MASK = ((uintptr_t(1) << DIFF_LENGTH_SHIFT) - 1) & ~DIFF_FLAG_MASK;
+
+static_assert(sizeof(uintptr_t) == 8, "tagged diffs need 64-bit pointers");
+static_assert(BITMAP_SIZE <= (int)DIFF_LENGTH_MASK, "bitmap length must fit the tag");
+
+/**
+ * A diff as loaded from a version node.
+ */
+struct DiffView {
+    uint16_t *data = nullptr;
+    DiffEncoding encoding = ENC_SPARSE;
+    int length = BITMAP_SIZE;                            // Logical bitmap length in bytes
+};
+
+/**
+ * Arena offset of a version node; 0 is the null offset.
+ */
+typedef uint32_t NodeOffset;
+const NodeOffset NULL_NODE = 0;
 
 /**
  * A differential bitmap version.
  * Each node represents one bitmap version with a specific CSN.
+ * Nodes live in the controller's NodeArena and link by 32-bit offsets.
  */
 struct CompressedBitmap {
     int bitmap_csn;                                      // Commit sequence number
-    std::atomic<CompressedBitmap*> next_bitmap;          // Next version in the chain
-    uint16_t *compressed_bitmap;                          // Differential or full bitmap
-    bool is_compressed;                                   // Compression flag
+    std::atomic<NodeOffset> next_bitmap;                 // Next version in the chain
+    std::atomic<uintptr_t> tagged_diff;                  // Encoding | length | diff pointer | flags
+
+    CompressedBitmap()
+        : bitmap_csn(0), next_bitmap(NULL_NODE), tagged_diff(0) {}
+
+    /**
+     * Load the diff pointer, encoding and length with a single read.
+     */
+    DiffView load_diff() const {
+        uintptr_t word = tagged_diff.load(std::memory_order_acquire);
+        DiffView view;
+        view.data = reinterpret_cast<uint16_t *>(word & DIFF_POINTER_MASK);
+        view.encoding = static_cast<DiffEncoding>(word >> DIFF_ENCODING_SHIFT);
+        view.length = (int)((word >> DIFF_LENGTH_SHIFT) & DIFF_LENGTH_MASK);
+        return view;
+    }
+
+    uint16_t *diff() const {
+        return reinterpret_cast<uint16_t *>(
+            tagged_diff.load(std::memory_order_acquire) & DIFF_POINTER_MASK);
+    }
+
+    bool is_ready() const {
+        return (tagged_diff.load(std::memory_order_acquire) & DIFF_READY) != 0;
+    }
+
+    bool is_dead() const {
+        return (tagged_diff.load(std::memory_order_acquire) & DIFF_DEAD) != 0;
+    }
+
+    /**
+     * Publish a diff; the node becomes ready.
+     */
+    void set_diff(const DiffView &view) {
+        uintptr_t word = reinterpret_cast<uintptr_t>(view.data);
+        assert((word & ~DIFF_POINTER_MASK) == 0);
+        assert(view.length >= 0 && view.length <= BITMAP_SIZE);
+        word |= DIFF_READY;
+        word |= (uintptr_t)view.length << DIFF_LENGTH_SHIFT;
+        word |= (uintptr_t)view.encoding << DIFF_ENCODING_SHIFT;
+        tagged_diff.store(word, std::memory_order_release);
+    }
+
+    void mark_dead() {
+        tagged_diff.fetch_or(DIFF_DEAD);
+    }
+
+    /**
+     * Mark the diff hot; returns whether it already was.
+     */
+    bool mark_hot() {
+        return (tagged_diff.fetch_or(DIFF_HOT) & DIFF_HOT) != 0;
+    }
+};
+
+static_assert(sizeof(CompressedBitmap) == 16, "version nodes should stay 16 bytes");
+
+/**
+ * Arena of version nodes addressed by 32-bit offsets.
+ * Chunk k holds (64 << k) nodes, so offsets resolve with one bit scan
+ * and chunks never move once published.
+ */
+class NodeArena {
+  public:
+    NodeArena() {
+        for (int i = 0; i < ARENA_CHUNKS; i++) chunks[i].store(nullptr);
+    }
+
+    ~NodeArena() {
+        for (int i = 0; i < ARENA_CHUNKS; i++) delete[] chunks[i].load();
+    }
+
+    NodeArena(const NodeArena &) = delete;
+    NodeArena &operator=(const NodeArena &) = delete;
+
+    /**
+     * Allocate a fresh node, reusing freed offsets first.
+     */
+    NodeOffset alloc() {
+        NodeOffset offset = NULL_NODE;
+        if (free_cnt.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lk(free_lock);
+            if (!free_list.empty()) {
+                offset = free_list.back();
+                free_list.pop_back();
+                free_cnt.fetch_sub(1);
+            }
+        }
+        if (offset == NULL_NODE) {
+            offset = next_offset.fetch_add(1);
+            ensure_chunk(offset);
+        }
+        CompressedBitmap *node = at(offset);
+        node->bitmap_csn = 0;
+        node->next_bitmap.store(NULL_NODE);
+        node->tagged_diff.store(0);
+        return offset;
+    }
+
+    /**
+     * Return a node for reuse.  The caller guarantees no reader holds it.
+     */
+    void free(NodeOffset offset) {
+        std::lock_guard<std::mutex> lk(free_lock);
+        free_list.push_back(offset);
+        free_cnt.fetch_add(1);
+    }
+
+    CompressedBitmap *at(NodeOffset offset) const {
+        if (offset == NULL_NODE) return nullptr;
+        int k;
+        uint64_t pos = locate(offset, k);
+        return chunks[k].load(std::memory_order_acquire) + pos;
+    }
+
+    /**
+     * Nodes currently in use.
+     */
+    size_t live_nodes() const {
+        return next_offset.load() - 1 - free_cnt.load();
+    }
+
+  private:
+    static const int ARENA_BASE_SHIFT = 6;
+    static const int ARENA_CHUNKS = 27;
+
+    std::atomic<CompressedBitmap *> chunks[ARENA_CHUNKS];
+    std::atomic<NodeOffset> next_offset{1};
+    std::mutex free_lock;
+    std::vector<NodeOffset> free_list;
+    std::atomic<size_t> free_cnt{0};
+
+    static uint64_t locate(NodeOffset offset, int &k) {
+        uint64_t v = (uint64_t)offset + (1ull << ARENA_BASE_SHIFT);
+        k = 63 - __builtin_clzll(v) - ARENA_BASE_SHIFT;
+        return v - ((1ull << ARENA_BASE_SHIFT) << k);
+    }
+
+    void ensure_chunk(NodeOffset offset) {
+        int k;
+        locate(offset, k);
+        if (chunks[k].load(std::memory_order_acquire) != nullptr) return;
+        CompressedBitmap *chunk = new CompressedBitmap[(size_t(1) << ARENA_BASE_SHIFT) << k];
+        CompressedBitmap *expected = nullptr;
+        if (!chunks[k].compare_exchange_strong(expected, chunk)) {
+            delete[] chunk;
+        }
+    }
+};
+
+/**
+ * Two-slot epoch reclamation for the lock-free read paths.
+ * Readers pin the current epoch while they traverse a chain.  Memory a
+ * writer unlinks is retired and freed only after every reader that
+ * entered before the unlink has left.
+ */
+class EpochReclaimer {
+  public:
+    EpochReclaimer() {}
+
+    ~EpochReclaimer() {
+        for (auto &r : retired) r.free_fn();
+    }
+
+    EpochReclaimer(const EpochReclaimer &) = delete;
+    EpochReclaimer &operator=(const EpochReclaimer &) = delete;
+
+    /**
+     * Pin the current epoch; returns the slot to pass to exit().
+     */
+    int enter() {
+        while (true) {
+            uint64_t e = epoch.load();
+            int slot = (int)(e & 1);
+            readers[slot].fetch_add(1);
+            if (epoch.load() == e) return slot;
+            readers[slot].fetch_sub(1);
+        }
+    }
+
+    void exit(int slot) {
+        readers[slot].fetch_sub(1);
+    }
+
+    /**
+     * Defer free_fn until no reader can reach the retired memory.  With
+     * grace_periods 2 it also waits out the readers that enter after the
+     * first advance, for memory a reader can still publish while it
+     * leaves.
+     */
+    void retire(std::function<void()> free_fn, size_t bytes, int grace_periods = 1) {
+        std::lock_guard<std::mutex> lk(retire_lock);
+        retired.push_back(Retired{epoch.load() + grace_periods - 1, std::move(free_fn), bytes});
+        retired_bytes.fetch_add(bytes);
+    }
+
+    /**
+     * Advance the epoch, wait for the readers of the previous one and
+     * free everything retired before the advance.  Must not be called
+     * while the calling thread holds a pin.  Returns the bytes freed.
+     */
+    size_t reclaim() {
+        std::lock_guard<std::mutex> reclaim_guard(reclaim_lock);
+        std::vector<Retired> ready;
+        uint64_t e;
+        {
+            std::lock_guard<std::mutex> lk(retire_lock);
+            e = epoch.load();
+            epoch.store(e + 1);
+            std::vector<Retired> later;
+            for (auto &r : retired) {
+                if (r.epoch <= e) ready.push_back(std::move(r));
+                else later.push_back(std::move(r));
+            }
+            retired.swap(later);
+        }
+        while (readers[e & 1].load() != 0) {
+            std::this_thread::yield();
+        }
+        size_t bytes = 0;
+        for (auto &r : ready) {
+            r.free_fn();
+            bytes += r.bytes;
+        }
+        retired_bytes.fetch_sub(bytes);
+        return bytes;
+    }
+
+    /**
+     * Bytes retired but not yet freed.
+     */
+    size_t get_retired_bytes() const {
+        return retired_bytes.load();
+    }
+
+  private:
+    struct Retired {
+        uint64_t epoch;
+        std::function<void()> free_fn;
+        size_t bytes;
+    };
+
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<int64_t> readers[2] = {};
+    std::mutex retire_lock;
+    std::mutex reclaim_lock;
+    std::vector<Retired> retired;
+    std::atomic<size_t> retired_bytes{0};
+};
+
+/**
+ * Scoped epoch pin.
+ */
+class EpochGuard {
+  public:
+    explicit EpochGuard(EpochReclaimer &reclaimer_ref)
+        : reclaimer(reclaimer_ref), slot(reclaimer_ref.enter()) {}
+
+    ~EpochGuard() { reclaimer.exit(slot); }
+
+  private:
+    EpochReclaimer &reclaimer;
+    int slot;
+};
+
+/**
+ * Version-sliced change matrix of a group.
+ * Row i is bit position rows[i]; bit s of masks[i] is set if the version
+ * in slot s differs from the reference at that position.  Rows are only
+ * appended and mask bits only set, so readers of a published slot never
+ * need a lock.  A full block is replaced by a larger copy.
+ */
+struct MatrixBlock {
+    std::atomic<uint32_t> len;                            // Rows in use
+    uint32_t capacity;
+    uint16_t *rows;
+    std::atomic<uint64_t> *masks;
+
+    explicit MatrixBlock(uint32_t capacity_ref)
+        : len(0), capacity(capacity_ref),
+          rows(new uint16_t[capacity_ref]),
+          masks(new std::atomic<uint64_t>[capacity_ref]) {}
+
+    ~MatrixBlock() {
+        delete[] rows;
+        delete[] masks;
+    }
+
+    size_t bytes() const {
+        return sizeof(MatrixBlock) + capacity * (sizeof(uint16_t) + sizeof(uint64_t));
+    }
+};
+
+const int PTREE_LEAF_POSITIONS = 32;                      // Positions per leaf block
+const int PTREE_FANOUT = 8;                               // Children per inner node
+const int PTREE_POOL_CHUNK = 16;                          // Nodes allocated at a time
+const int PTREE_MIN_POSITIONS = 4 * PTREE_LEAF_POSITIONS; // Smaller diffs stay sparse
+
+/**
+ * Node of a group's persistent position tree.  A leaf holds a sorted
+ * block of bit positions; an inner node holds children ordered by their
+ * first position.  Nodes are immutable once a published version can
+ * reach them: an update copies the path from the root to each changed
+ * leaf and shares every other node with the previous version.
+ */
+struct PtreeNode {
+    uint32_t size;                                        // Positions below this node
+    uint16_t first;                                       // Smallest position below this node
+    uint8_t count;                                        // Positions (leaf) or children (inner)
+    bool leaf;
+    union {
+        uint16_t positions[PTREE_LEAF_POSITIONS];
+        const PtreeNode *children[PTREE_FANOUT];
+    };
+};
+
+/**
+ * Nodes of every version of a group's position tree.  Only the writer
+ * holding ref_lock allocates; nodes live until the group is freed.
+ */
+struct PtreePool {
+    std::vector<PtreeNode *> chunks;
+    int used = PTREE_POOL_CHUNK;                          // Nodes handed out from the last chunk
+
+    ~PtreePool() {
+        for (PtreeNode *chunk : chunks) delete[] chunk;
+    }
+
+    PtreeNode *alloc() {
+        if (used == PTREE_POOL_CHUNK) {
+            chunks.push_back(new PtreeNode[PTREE_POOL_CHUNK]);
+            used = 0;
+        }
+        return &chunks.back()[used++];
+    }
+
+    size_t nodes() const {
+        return chunks.empty() ? 0 : (chunks.size() - 1) * PTREE_POOL_CHUNK + used;
+    }
+
+    /**
+     * Free every node allocated after nodes() was mark.  Only valid while
+     * none of them is published.
+     */
+    void rollback(size_t mark) {
+        size_t keep_chunks = (mark + PTREE_POOL_CHUNK - 1) / PTREE_POOL_CHUNK;
+        while (chunks.size() > keep_chunks) {
+            delete[] chunks.back();
+            chunks.pop_back();
+        }
+        used = chunks.empty() ? PTREE_POOL_CHUNK : (int)(mark - (chunks.size() - 1) * PTREE_POOL_CHUNK);
+    }
+
+    size_t bytes() const {
+        return sizeof(PtreePool) + chunks.size() * PTREE_POOL_CHUNK * sizeof(PtreeNode);
+    }
+};
+
+struct BitmapRef;
+
+/**
+ * Reference of a delta group: a diff against another group's reference.
+ * Immutable; GC replaces it as a whole when it rebases the group.
+ */
+struct ReferenceDelta {
+    BitmapRef *base;
+    DiffView diff;                                        // Over the group's capacity bytes
+
+    ~ReferenceDelta() {
+        delete[] diff.data;
+    }
+};
+
+/**
+ * Reference bitmap (group head).
+ * Maintains a complete bitmap and a chain of differential versions.
+ */
+struct BitmapRef {
+    SiteLock<std::mutex> ref_lock;                        // Synchronization for group updates
+    int bitmap_cnt;                                       // Number of versions in this group
+    int pending_cnt;                                      // Reserved versions not yet published
+    int bitmap_len;                                       // Logical length of the reference
+    int capacity;                                         // Allocated bytes, zero beyond bitmap_len
+    std::atomic<NodeOffset> first_compressed_bitmap;      // Newest version in the group
+    std::pair<int, int> csn_range;                         // CSN range covered by this group
+    std::atomic<BitmapRef*> next_ref;                      // Next group
+    const uint8_t *complete_bitmap;                        // Reference bitmap, read-only once published
+    bool interned;                                        // complete_bitmap is a ReferencePool page
+    ReferenceFill fill;                                   // Uniform content of the reference, if any
+
+    // Delta mode: complete_bitmap is null and the reference is
+    // reference_delta applied to its base's reference.  A delta group
+    // without a delta keeps its reference in cached_reference for good.
+    std::atomic<ReferenceDelta*> reference_delta;         // Null for anchors
+    int anchor_distance;                                  // Deltas from here down to an anchor
+    std::atomic<const uint8_t*> cached_reference;         // Materialized reference, owned
+    std::atomic<uint32_t> reference_reads;                // Reads of a delta reference since the last refresh
+
+    // Monotone mode: positions set after the reference, appended in CSN
+    // order.  A version encoded as ENC_LOG is the reference plus a prefix.
+    std::atomic<uint16_t*> delete_log;
+    int log_len;                                          // Entries in delete_log
+    int log_capacity;                                     // Allocated entries
+    int log_tail_csn;                                     // Newest version encoded as a prefix
+    bool log_frozen;                                      // A version cleared a bit
+
+    // Matrix mode: changed rows of every version, one column per slot.
+    std::atomic<MatrixBlock*> matrix;
+    std::unordered_map<uint16_t, uint32_t> matrix_index;  // Position -> row, writers only
+    int matrix_slots;                                     // Slots handed out
+
+    // Position tree mode: published sparse diffs, re-encoded in CSN order
+    // as roots of a persistent tree shared by the group's versions.
+    PtreePool *ptree_pool;                                // Writers only
+    const PtreeNode *ptree_tail_root;                     // Tree of the newest re-encoded version
+    int ptree_tail_csn;                                   // Newest version considered for re-encoding
+
+    std::atomic<int> share_cnt;                           // Controllers holding this group after fork()
+    std::atomic<bool> unlinked;                           // Removed by GC, never a read hint again
+
+    BitmapRef()
+        : ref_lock("ref_lock"), bitmap_cnt(0), pending_cnt(0),
+          bitmap_len(0), capacity(0),
+          first_compressed_bitmap(NULL_NODE),
+          csn_range(0, 0), next_ref(nullptr),
+          complete_bitmap(nullptr), interned(false), fill(FILL_NONE), reference_delta(nullptr),
+          anchor_distance(0), cached_reference(nullptr), reference_reads(0),
+          delete_log(nullptr),
+          log_len(0), log_capacity(0), log_tail_csn(0), log_frozen(false),
+          matrix(nullptr), matrix_slots(0),
+          ptree_pool(nullptr), ptree_tail_root(nullptr), ptree_tail_csn(0),
+          share_cnt(1), unlinked(false) {}
+
+    ~BitmapRef() {
+        delete[] delete_log.load();
+        delete matrix.load();
+        delete ptree_pool;
+    }
+};
+
+/**
+ * Bounded lock-free multi-producer/multi-consumer queue (Vyukov).
+ * Used to connect the stages of the commit pipeline.
+ */
+template <class T>
+class BoundedMpmcQueue {
+  public:
+    explicit BoundedMpmcQueue(size_t capacity) {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask = cap - 1;
+        cells = new Cell[cap];
+        for (size_t i = 0; i < cap; i++) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~BoundedMpmcQueue() { delete[] cells; }
+
+    bool try_push(const T &value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = cells[pos & mask];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T &value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = cells[pos & mask];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t size_approx() const {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
+    }
+
+  private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    Cell *cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+/**
+ * Stages of the commit path.
+ * RESERVE runs in insert_null, the others in insert_bitmap_content
+ * or on the background pipeline workers.
+ */
+enum CommitStage {
+    STAGE_RESERVE = 0,                                    // Claim a slot and link the placeholder
+    STAGE_DIFF,                                           // Compute the differential encoding
+    STAGE_LINK,                                           // Attach the encoding to the placeholder
+    STAGE_CONSOLIDATE,                                    // Union cascade into newer versions
+    STAGE_PUBLISH,                                        // Advance the visible CSN range
+    STAGE_NUM
+};
+
+static const char *const commit_stage_names[STAGE_NUM] = {
+    "reserve", "diff", "link", "consolidate", "publish"
+};
+
+/**
+ * Controller options.
+ */
+struct ControllerConfig {
+    bool pipelined_commit = false;                        // Run DIFF..PUBLISH on background workers
+    int pipeline_workers = 1;                             // Number of pipeline worker threads
+    size_t pipeline_queue_capacity = 1024;                // Capacity of each stage queue
+    int64_t time_index_granularity_us = 1000;             // Sampling granularity of the time index
+
+    // Retention policy.  Versions visible to an active snapshot are always
+    // kept.  Versions newer than the horizon are kept; older ones are thinned
+    // to the newest version per granularity bucket (none if 0).  When memory
+    // exceeds the budget the buckets beyond the horizon are widened.
+    int64_t retention_horizon_us = 0;                     // Keep everything newer than this
+    int64_t retention_granularity_us = 0;                 // Thinning bucket beyond the horizon
+    size_t memory_budget_bytes = 0;                       // 0 disables the budget
+    int gc_interval_ms = 0;                               // Background GC period, 0 disables it
+
+    // Versions only ever set bits (delete bitmaps).  In-order versions are
+    // stored as prefixes of a per-group delete log and the union cascade is
+    // skipped; a version that clears a bit falls back to a regular diff.
+    bool monotone_deletes = false;
+
+    // Store each group as a version-sliced change matrix instead of
+    // cumulative diffs.  Takes precedence over monotone_deletes.
+    bool matrix_groups = false;
+    int group_versions = MAX_COMPRESS_NUM;                // Versions per group, <= 64 with matrix_groups
+
+    // Cumulative sparse diffs share most positions with the previous
+    // version.  Once published in order, each is re-encoded as the root
+    // of a persistent B-tree of position blocks that shares unchanged
+    // blocks with its predecessor.  Ignored with matrix_groups and for
+    // groups whose delete log is in use.
+    bool position_trees = false;
+
+    // QoS between commits, reads and background work, off when the target
+    // is 0.  While the commit latency EWMA exceeds the target, GC yields
+    // between groups and analytical reads (get_bitmaps, get_bitmap_at_time)
+    // are paced; commits and point reads are never delayed.
+    int64_t commit_latency_target_ns = 0;
+    double analytic_overload_rate = 1000;                 // Analytical versions per second when overloaded
+    int max_background_delay_ms = 100;                    // Longest wait per yield or analytical request
+
+    // Readers shorten the paths they walk.  A reader that skipped many
+    // groups leaves a hint to the group it found, and a reader that had to
+    // decode a delete-log prefix or change matrix larger than a dense diff
+    // re-encodes that version as a regular diff when its group is unlocked.
+    bool reader_assist = true;
+
+    // Hash-cons group references into the process-wide ReferencePool, so
+    // byte-identical references (e.g. all-empty row groups) share a page.
+    // The pool's bytes count towards memory_budget_bytes and pressure of
+    // every interning controller, as they are shared across controllers.
+    bool intern_references = false;
+
+    // Store a new group's reference as a diff against the previous group's
+    // reference, with a full anchor every reference_anchor_interval groups
+    // and whenever the diff is not much smaller than the reference.  The
+    // head group keeps a materialized copy for commits; older groups keep
+    // one while hot, i.e. read reference_cache_reads times between two
+    // refreshes (GC passes, and once when a group leaves the two newest).
+    // Before GC frees a base, its dependents are re-encoded against an
+    // older group (re-anchored).
+    bool delta_references = false;
+    int reference_anchor_interval = 8;
+    uint32_t reference_cache_reads = 4;
+
+    // Commit admission (admit_commit), off when admission_max_delay_us is 0.
+    // Pressure is the largest of memory over memory_budget_bytes, retired
+    // bytes over retired_bytes_limit and reserved-but-unpublished versions
+    // over pending_versions_limit (each ignored when 0).  Above
+    // admission_soft_pressure commits are delayed in proportion to the
+    // excess; at full pressure they wait, up to admission_max_wait_ms.
+    double admission_soft_pressure = 0.8;
+    int admission_max_delay_us = 0;
+    int admission_max_wait_ms = 100;
+    size_t retired_bytes_limit = 0;
+    size_t pending_versions_limit = 0;
+};
+
+/**
+ * Backpressure signal of a controller.
+ */
+struct ControllerPressure {
+    size_t memory_bytes = 0;                              // Live plus retired
+    size_t memory_budget_bytes = 0;
+    size_t retired_bytes = 0;                             // Retired but not yet freed
+    size_t retired_bytes_limit = 0;
+    size_t pending_versions = 0;                          // Reserved but not yet published
+    size_t pending_versions_limit = 0;
+    double level = 0;                                     // Largest ratio to its limit, 1 is full
+
+    void print(std::ostream &os) const {
+        os << "pressure " << level << ": memory " << memory_bytes << "/" << memory_budget_bytes
+           << ", retired " << retired_bytes << "/" << retired_bytes_limit
+           << ", pending " << pending_versions << "/" << pending_versions_limit << std::endl;
+    }
+};
+
+/**
+ * Snapshot of controller counters.
+ */
+struct ControllerStats {
+    uint64_t stage_count[STAGE_NUM] = {};                 // Completed operations per stage
+    uint64_t stage_ns[STAGE_NUM] = {};                    // Accumulated time per stage
+    size_t version_nodes = 0;                             // Live version nodes in the arena
+    size_t version_node_bytes = 0;                        // Arena bytes held by live nodes
+    size_t time_index_entries = 0;                        // Samples in the time-to-CSN index
+    size_t memory_bytes = 0;                              // Groups, nodes and diffs, incl. retired
+    size_t retired_bytes = 0;                             // Retired but not yet freed
+    uint64_t gc_runs = 0;                                 // Completed GC passes
+    uint64_t gc_versions_freed = 0;                       // Versions removed by GC
+    uint64_t gc_groups_freed = 0;                         // Groups removed by GC
+    uint64_t log_versions = 0;                            // Versions stored as delete-log prefixes
+    uint64_t log_fallbacks = 0;                           // Groups whose delete log was frozen
+    uint64_t matrix_versions = 0;                         // Versions stored as matrix columns
+    uint64_t ptree_versions = 0;                          // Versions stored as position tree roots
+    uint64_t ptree_positions = 0;                         // Positions of those versions
+    uint64_t ptree_nodes = 0;                             // Tree nodes allocated for them
+    uint64_t read_hint_updates = 0;                       // Group hints left by readers
+    uint64_t reader_consolidations = 0;                   // Versions re-encoded by readers
+    uint64_t admission_delayed = 0;                       // Commits delayed by admit_commit
+    uint64_t csn_waits = 0;                               // wait_for_csn calls that blocked
+    uint64_t csn_wakes = 0;                               // Publishes that woke waiters
+    uint64_t delta_references = 0;                        // Groups created with a delta reference
+    uint64_t reference_cache_fills = 0;                   // Delta references materialized for readers
+    uint64_t reference_cache_drops = 0;                   // Unread materialized references dropped
+    uint64_t reference_reanchors = 0;                     // Delta references re-encoded when GC freed their base
+    uint64_t admission_delay_us = 0;                      // Total admission delay
+    uint64_t pipeline_submitted = 0;                      // Commits handed to the pipeline
+    uint64_t pipeline_completed = 0;                      // Commits published by the pipeline
+    size_t pipeline_diff_queue = 0;                       // Pending jobs before DIFF
+    size_t pipeline_publish_queue = 0;                    // Pending jobs before CONSOLIDATE
+    ReferencePoolStats reference_pool;                    // Process-wide, shared by all controllers
+    QosStats qos;                                         // Disabled unless a latency target is set
+    std::vector<LockSiteSnapshot> lock_sites;             // Empty unless built with Lock_Profile
+
+    void print(std::ostream &os) const {
+        os << "commit pipeline stages:" << std::endl;
+        for (int i = 0; i < STAGE_NUM; i++) {
+            double avg_ns = stage_count[i] ? (double)stage_ns[i] / stage_count[i] : 0.0;
+            double ops = stage_ns[i] ? stage_count[i] / (stage_ns[i] / 1e9) : 0.0;
+            os << "  " << commit_stage_names[i]
+               << ": count " << stage_count[i]
+               << ", avg " << avg_ns << " ns"
+               << ", " << (uint64_t)ops << " op/s" << std::endl;
+        }
+        os << "  pipeline submitted " << pipeline_submitted
+           << ", completed " << pipeline_completed
+           << ", queued " << pipeline_diff_queue << "/"
+           << pipeline_publish_queue << std::endl;
+        os << "version nodes: " << version_nodes
+           << " (" << version_node_bytes << " bytes)" << std::endl;
+        os << "time index entries: " << time_index_entries << std::endl;
+        os << "memory: " << memory_bytes << " bytes, retired " << retired_bytes
+           << " bytes; gc runs " << gc_runs << ", freed " << gc_versions_freed
+           << " versions / " << gc_groups_freed << " groups" << std::endl;
+        if (matrix_versions > 0) {
+            os << "change matrix: " << matrix_versions << " versions" << std::endl;
+        }
+        if (ptree_versions > 0) {
+            os << "position trees: " << ptree_versions << " versions, " << ptree_nodes
+               << " nodes (" << ptree_nodes * sizeof(PtreeNode) << " bytes) for "
+               << ptree_positions << " positions (" << ptree_positions * sizeof(uint16_t)
+               << " bytes as sparse diffs)" << std::endl;
+        }
+        if (log_versions > 0 || log_fallbacks > 0) {
+            os << "delete log: " << log_versions << " versions, "
+               << log_fallbacks << " fallbacks" << std::endl;
+        }
+        if (read_hint_updates > 0 || reader_consolidations > 0) {
+            os << "reader assist: " << read_hint_updates << " hints, "
+               << reader_consolidations << " versions re-encoded" << std::endl;
+        }
+        if (admission_delayed > 0) {
+            os << "admission: " << admission_delayed << " commits delayed, "
+               << admission_delay_us << " us" << std::endl;
+        }
+        if (csn_waits > 0) {
+            os << "csn waits: " << csn_waits << " blocked, " << csn_wakes << " wakes" << std::endl;
+        }
+        if (delta_references > 0) {
+            os << "delta references: " << delta_references << " groups, cache "
+               << reference_cache_fills << " fills / " << reference_cache_drops
+               << " drops, " << reference_reanchors << " re-anchored" << std::endl;
+        }
+        reference_pool.print(os);
+        qos.print(os);
+        print_lock_profile(os, lock_sites);
+    }
+};
+
+/**
+ * Expected cost of reading one version, for planners choosing scan
+ * order and parallelism without reconstructing anything.
+ */
+struct ReadCostEstimate {
+    bool found = false;                                   // A retained version answers the CSN
+    bool ready = false;                                   // That version is published
+    int version_csn = -1;                                 // Newest retained CSN <= the requested one
+    int group_csn = -1;                                   // First CSN of the owning group
+    int groups_walked = 0;                                // Groups skipped to reach it
+    int versions_walked = 0;                              // Chain nodes skipped within the group
+    DiffEncoding encoding = ENC_SPARSE;
+    int bitmap_len = 0;                                   // Logical length of the result
+    size_t diff_bytes = 0;                                // Encoded bytes applied to the reference
+    size_t bytes_touched = 0;                             // Reference copy plus diff bytes read
+    bool resident = true;                                 // Groups are never spilled in this tree
+    bool reference_copy = false;                          // Empty diff: the read is a single memcpy
+};
+
+/**
+ * What one get_bitmap_as_of call actually read, counted on the read
+ * path so estimate_read_cost can be checked against it.
+ */
+struct ReadTrace {
+    int version_csn = -1;                                 // Version that answered the CSN
+    DiffEncoding encoding = ENC_SPARSE;
+    int bitmap_len = 0;
+    size_t reference_bytes = 0;                           // Reference bytes filled, copied or decoded
+    size_t diff_bytes = 0;                                // Encoded bytes applied to the reference
+};
+
+/**
+ * Diff log record kinds shipped to read replicas.
+ */
+enum DiffLogType : uint32_t {
+    LOG_GROUP = 1,                                        // New group with its reference bitmap
+    LOG_VERSION = 2,                                      // Published version with its encoded diff
+    LOG_HEARTBEAT = 3,                                    // Primary high-water CSN only
+    LOG_DROP = 4                                          // Version of a group removed by GC
+};
+
+/**
+ * Fixed-size part of a diff log record.
+ */
+struct DiffLogHeader {
+    uint32_t type = 0;
+    int32_t csn = 0;                                      // Version CSN
+    int32_t group_csn = 0;                                // First CSN of the owning group
+    int32_t union_from_csn = -1;                          // First version that took the union cascade
+    int32_t published_csn = 0;                            // Group's visible upper bound afterwards
+    int32_t high_water_csn = 0;                           // Highest CSN published by the primary
+    int32_t visible_csn = -1;                             // Primary's contiguous published watermark
+    uint32_t encoding = ENC_SPARSE;                       // DiffEncoding of a version payload
+    int32_t bitmap_len = BITMAP_SIZE;                     // Logical bitmap length in bytes
+    uint32_t payload_bytes = 0;                           // Size of the payload that follows
+};
+
+/**
+ * A diff log record.  The payload is the encoded data exactly as the
+ * primary stores it, so replicas never recompress.  It is only valid
+ * during the sink callback.
+ */
+struct DiffLogRecord {
+    DiffLogHeader header;
+    const void *payload = nullptr;
+};
+
+using DiffLogSink = std::function<void(const DiffLogRecord &)>;
+
+/**
+ * Identity of a group's published content, compared between incremental
+ * checkpoints.  Re-encoding a version leaves it unchanged; publishing or
+ * collecting one changes it.
+ */
+struct GroupFingerprint {
+    int group_csn = 0;                                    // First CSN of the group
+    int published_csn = 0;                                // Newest published version
+    int versions = 0;                                     // Published versions
+    uint64_t fingerprint = 0;                             // Hash of the length and published CSNs
+};
+
+/**
+ * One input version of BitmapController::bulk_load.  Either bitmap holds
+ * the full version, or delta lists the bit positions flipped relative to
+ * the previous input version.
+ */
+struct BulkVersion {
+    int csn = 0;
+    const uint8_t *bitmap = nullptr;                      // Full version of bitmap_len bytes
+    const uint16_t *delta = nullptr;                      // Flipped positions, if bitmap is null
+    int delta_cnt = 0;
+    int bitmap_len = BITMAP_SIZE;
+    int64_t commit_ts_us = 0;                             // Original commit time, 0 for the load time
+};
+
+/**
+ * Read-only view of a version that is exactly its group reference.
+ * Holds a pool reference, so it stays valid after GC frees the group.
+ */
+class ReferenceView {
+  public:
+    ReferenceView() {}
+
+    ~ReferenceView() {
+        reset();
+    }
+
+    ReferenceView(const ReferenceView &) = delete;
+    ReferenceView &operator=(const ReferenceView &) = delete;
+
+    const uint8_t *data() const { return page; }
+
+    int length() const { return len; }
+
+    /**
+     * Point at an interned page the caller already holds a reference to.
+     */
+    void assign(const uint8_t *page_ref, int len_ref) {
+        reset();
+        page = page_ref;
+        len = len_ref;
+    }
+
+    void reset() {
+        if (page != nullptr) ReferencePool::instance().release(page);
+        page = nullptr;
+        len = 0;
+    }
+
+  private:
+    const uint8_t *page = nullptr;
+    int len = 0;
+};
+
+/**
+ * BitmapController manages multi-version bitmap chains with
+ * hierarchical grouped differential encoding.
+ */
+class BitmapController {
+  public:
+    BitmapController(std::vector<int>& tsn_list_ref,
+                     const ControllerConfig &config_ref = ControllerConfig())
+        : BitmapController(tsn_list_ref, config_ref, DeferWorkers())
+    {
+        start_workers();
+    }
+
+    /**
+     * Build a controller from a CSN-ordered version sequence with bulk_load.
+     */
+    BitmapController(std::vector<int>& tsn_list_ref,
+                     const std::vector<BulkVersion> &versions,
+                     const ControllerConfig &config_ref = ControllerConfig(),
+                     int threads = 0)
+        : BitmapController(tsn_list_ref, config_ref)
+    {
+        if (!bulk_load(versions, threads)) {
+            throw std::invalid_argument("bulk_load: versions are not CSN-ordered");
+        }
+    }
+
+    ~BitmapController() {
+        stop_pipeline();
+        stop_flag.store(true);
+        if (worker.joinable()) worker.join();
+        BitmapRef *ref = first_ref.load();
+        while (ref != nullptr) {
+            BitmapRef *next = ref->next_ref.load();
+            if (ref->share_cnt.fetch_sub(1) == 1) {
+                NodeOffset offset = ref->first_compressed_bitmap.load();
+                while (offset != NULL_NODE) {
+                    CompressedBitmap *node = node_at(offset);
+                    NodeOffset next_offset = node->next_bitmap.load();
+                    delete[] node->diff();
+                    arena->free(offset);
+                    offset = next_offset;
+                }
+                release_reference(ref);
+                delete ref;
+            }
+            ref = next;
+        }
+    }
+
+    /**
+     * Bitwise XOR for bitmap difference computation.
+     */
+    static void xor_function(uint8_t *a, uint8_t *b, uint8_t *result) {
+        for (size_t i = 0; i < BITMAP_SIZE; ++i) {
+            result[i] = a[i] ^ b[i];
+        }
+    }
+
+    /**
+     * Union two sorted sparse bitmap arrays.
+     */
+    static void union_sorted_array(uint16_t*& a, uint16_t* b) {
+        int a_size = a[0];
+        int b_size = b[0];
+
+        uint16_t* a_data = a + 1;
+        uint16_t* b_data = b + 1;
+
+        uint16_t* temp = new uint16_t[a_size + b_size + 1];
+        int i = 0, j = 0, k = 1;
+
+        while (i < a_size && j < b_size) {
+            if (a_data[i] < b_data[j]) {
+                temp[k++] = a_data[i++];
+            } else if (a_data[i] > b_data[j]) {
+                temp[k++] = b_data[j++];
+            } else {
+                temp[k++] = a_data[i];
+                i++; j++;
+            }
+        }
+        while (i < a_size) temp[k++] = a_data[i++];
+        while (j < b_size) temp[k++] = b_data[j++];
+
+        temp[0] = k - 1;
+
+        delete[] a;
+        a = new uint16_t[k];
+        for (int t = 0; t < k; t++) {
+            a[t] = temp[t];
+        }
+        delete[] temp;
+    }
+
+    /**
+     * Allocation size for a reference of the given logical length.
+     * References grow geometrically so appended row groups do not pay
+     * for BITMAP_SIZE up front.
+     */
+    static int bitmap_capacity(int bitmap_len) {
+        int capacity = 64;
+        while (capacity < bitmap_len) capacity <<= 1;
+        return std::min(capacity, BITMAP_SIZE);
+    }
+
+    /**
+     * Compress a bitmap version of bitmap_len bytes using differential
+     * encoding against a reference that is zero beyond its own length.
+     * Runs of flipped bits, such as appended ranges, are stored as runs;
+     * dense differences fall back to a full XOR image.
+     */
+    DiffView compress_bitmap(uint8_t *original_bitmap,
+                             int bitmap_len,
+                             const uint8_t *complete_bitmap) {
+        uint8_t *temp = new uint8_t[bitmap_len];
+        for (int i = 0; i < bitmap_len; i++) {
+            temp[i] = original_bitmap[i] ^ complete_bitmap[i];
+        }
+
+        int total_cnt = 0;
+        int run_cnt = 0;
+        uint8_t prev = 0;
+        for (int i = 0; i < bitmap_len; i++) {
+            if (temp[i] != 0) {
+                total_cnt += __builtin_popcount(temp[i]);
+                uint8_t predecessor = (uint8_t)((temp[i] >> 1) | ((prev & 1) << 7));
+                run_cnt += __builtin_popcount(temp[i] & (uint8_t)~predecessor);
+            }
+            prev = temp[i];
+        }
+
+        DiffView view;
+        view.length = bitmap_len;
+        if (2 * run_cnt + 1 <= (total_cnt + 1) / 2) {
+            view.encoding = ENC_RUNS;
+            view.data = new uint16_t[2 * run_cnt + 1];
+            view.data[0] = run_cnt;
+            int pos = 1;
+            int run_start = -1;
+            for (int bit = 0; bit <= bitmap_len * 8; bit++) {
+                if (bit % 8 == 0 && bit < bitmap_len * 8 && run_start < 0 && temp[bit / 8] == 0) {
+                    bit += 7;
+                    continue;
+                }
+                bool set = bit < bitmap_len * 8 && (temp[bit / 8] & (1 << (7 - bit % 8)));
+                if (set && run_start < 0) {
+                    run_start = bit;
+                } else if (!set && run_start >= 0) {
+                    view.data[pos++] = run_start;
+                    view.data[pos++] = bit - run_start;
+                    run_start = -1;
+                }
+            }
+        } else if (total_cnt >= bitmap_len / 16 && total_cnt > 0) {
+            view.encoding = ENC_DENSE;
+            int words = (bitmap_len + 1) / 2;
+            view.data = new uint16_t[words];
+            for (int i = 0; i < words; i++) {
+                uint16_t hi = 2 * i + 1 < bitmap_len ? temp[2 * i + 1] : 0;
+                view.data[i] = static_cast<uint16_t>(temp[2 * i]) |
+                               static_cast<uint16_t>(hi << 8);
+            }
+        } else {
+            view.encoding = ENC_SPARSE;
+            view.data = new uint16_t[total_cnt + 1];
+            view.data[0] = total_cnt;
+            int pos = 1;
+            for (int i = 0; i < bitmap_len; i++) {
+                if (temp[i] != 0) {
+                    for (int j = 0; j < 8; j++) {
+                        if (temp[i] & (1 << (7 - j))) {
+                            view.data[pos++] = i * 8 + j;
+                        }
+                    }
+                }
+            }
+        }
+        delete[] temp;
+        return view;
+    }
+
+    /**
+     * Flip count bits starting at bit position start.
+     */
+    static void xor_bit_range(uint8_t *bitmap, int start, int count) {
+        int pos = start;
+        int end = start + count;
+        while (pos < end && (pos % 8) != 0) {
+            bitmap[pos / 8] ^= (1 << (7 - pos % 8));
+            pos++;
+        }
+        while (pos + 8 <= end) {
+            bitmap[pos / 8] ^= 0xFF;
+            pos += 8;
+        }
+        while (pos < end) {
+            bitmap[pos / 8] ^= (1 << (7 - pos % 8));
+            pos++;
+        }
+    }
+
+    /**
+     * Union two differential bitmaps into a newly allocated one, leaving
+     * the inputs intact for concurrent readers.
+     * Dense (uncompressed) diffs are XOR images, so the union is a bitwise OR.
+     */
+    static DiffView union_diff(const DiffView &a, const DiffView &b) {
+        DiffView result;
+        result.length = a.length;
+        if (a.encoding == ENC_SPARSE && b.encoding == ENC_SPARSE) {
+            result.encoding = ENC_SPARSE;
+            result.data = new uint16_t[a.data[0] + 1];
+            memcpy(result.data, a.data, (a.data[0] + 1) * sizeof(uint16_t));
+            union_sorted_array(result.data, b.data);
+            return result;
+        }
+        result.encoding = ENC_DENSE;
+        int words = (result.length + 1) / 2;
+        int limit = result.length * 8;
+        result.data = new uint16_t[words]();
+        const DiffView *diffs[2] = {&a, &b};
+        for (const DiffView *d : diffs) {
+            if (d->encoding == ENC_SPARSE) {
+                for (int i = 1; i <= d->data[0]; i++) {
+                    if (d->data[i] < limit) result.data[d->data[i] / 16] |= dense_bit(d->data[i]);
+                }
+            } else if (d->encoding == ENC_RUNS) {
+                for (int r = 0; r < d->data[0]; r++) {
+                    int end = std::min(limit, d->data[1 + 2 * r] + d->data[2 + 2 * r]);
+                    for (int pos = d->data[1 + 2 * r]; pos < end; pos++) {
+                        result.data[pos / 16] |= dense_bit(pos);
+                    }
+                }
+            } else {
+                int d_words = std::min(words, (d->length + 1) / 2);
+                for (int i = 0; i < d_words; i++) {
+                    result.data[i] |= d->data[i];
+                }
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Mask of bit position pos inside its 16-bit dense word.
+     */
+    static uint16_t dense_bit(int pos) {
+        int byte_index = pos / 8;
+        int bit_index = pos % 8;
+        return static_cast<uint16_t>((1 << (7 - bit_index)) << ((byte_index & 1) * 8));
+    }
+
+    /**
+     * Reconstruct a visible bitmap version from reference and differential bitmap.
+     */
+    void decompress_bitmap(uint8_t *bitmap_result,
+                           const uint8_t *complete_bitmap,
+                           const DiffView &diff) {
+        memcpy(bitmap_result, complete_bitmap, diff.length);
+        apply_diff(bitmap_result, diff);
+    }
+
+    /**
+     * XOR a regular (sparse, dense or runs) diff into a bitmap.  Returns
+     * the encoded bytes applied, 0 for an empty sparse diff.
+     */
+    static size_t apply_diff(uint8_t *bitmap_result, const DiffView &diff) {
+        int bitmap_len = diff.length;
+        uint16_t *compressed_bitmap = diff.data;
+
+        if (diff.encoding == ENC_DENSE) {
+            for (int i = 0; i < bitmap_len / 2; i++) {
+                bitmap_result[2 * i] ^= compressed_bitmap[i] & 0xFF;
+                bitmap_result[2 * i + 1] ^= (compressed_bitmap[i] >> 8) & 0xFF;
+            }
+            if (bitmap_len % 2) {
+                bitmap_result[bitmap_len - 1] ^= compressed_bitmap[bitmap_len / 2] & 0xFF;
+            }
+            return (bitmap_len + 1) / 2 * sizeof(uint16_t);
+        } else if (diff.encoding == ENC_RUNS) {
+            int run_cnt = compressed_bitmap[0];
+            for (int r = 0; r < run_cnt; r++) {
+                xor_bit_range(bitmap_result, compressed_bitmap[1 + 2 * r],
+                              compressed_bitmap[2 + 2 * r]);
+            }
+            return (2 * run_cnt + 1) * sizeof(uint16_t);
+        } else {
+            int total_cnt = compressed_bitmap[0];
+            for (int i = 1; i <= total_cnt; i++) {
+                int pos = compressed_bitmap[i];
+                int byte_index = pos / 8;
+                int bit_index = pos % 8;
+                bitmap_result[byte_index] ^= (1 << (7 - bit_index));
+            }
+            return total_cnt == 0 ? 0 : (total_cnt + 1) * sizeof(uint16_t);
+        }
+    }
+
+    /**
+     * Reconstruct a version of ref from its diff.  With trace, the bytes
+     * read from the reference and the diff are added to it.
+     */
+    void reconstruct(uint8_t *bitmap_result, BitmapRef *ref, const DiffView &diff,
+                     ReadTrace *trace = nullptr) {
+        copy_reference(bitmap_result, ref, diff.length, trace);
+        if (trace != nullptr) {
+            trace->encoding = diff.encoding;
+            trace->bitmap_len = diff.length;
+        }
+        if (diff.encoding == ENC_MATRIX) {
+            uint32_t rows = apply_matrix(ref, 1ull << diff.data[0], &bitmap_result);
+            if (trace != nullptr) trace->diff_bytes += rows * (sizeof(uint16_t) + sizeof(uint64_t));
+            return;
+        }
+        if (diff.encoding == ENC_PTREE) {
+            for_each_ptree_leaf(ptree_root(diff), [&](const PtreeNode *leaf) {
+                for (int i = 0; i < leaf->count; i++) {
+                    int pos = leaf->positions[i];
+                    bitmap_result[pos / 8] ^= (1 << (7 - pos % 8));
+                }
+                if (trace != nullptr) trace->diff_bytes += leaf->count * sizeof(uint16_t);
+                return true;
+            });
+            return;
+        }
+        if (diff.encoding != ENC_LOG) {
+            size_t applied = apply_diff(bitmap_result, diff);
+            if (trace != nullptr) trace->diff_bytes += applied;
+            return;
+        }
+        const uint16_t *log = ref->delete_log.load(std::memory_order_acquire);
+        uint32_t prefix = log_prefix(diff);
+        for (uint32_t i = 0; i < prefix; i++) {
+            bitmap_result[log[i] / 8] |= (1 << (7 - log[i] % 8));
+        }
+        if (trace != nullptr) trace->diff_bytes += prefix * sizeof(uint16_t);
+    }
+
+    /**
+     * Copy the first len bytes of a group reference; uniform references
+     * are produced with a fill instead of a copy, and delta references
+     * without a materialized copy are rebuilt from their anchor.
+     */
+    void copy_reference(uint8_t *bitmap_result, BitmapRef *ref, int len,
+                        ReadTrace *trace = nullptr) {
+        if (trace != nullptr && (ref->fill != FILL_NONE || resident_reference(ref) != nullptr)) {
+            trace->reference_bytes += len;
+        }
+        if (ref->fill == FILL_ZEROS) {
+            memset(bitmap_result, 0, len);
+        } else if (ref->fill == FILL_ONES) {
+            int ones = std::min(len, ref->bitmap_len);
+            memset(bitmap_result, 0xFF, ones);
+            memset(bitmap_result + ones, 0, len - ones);
+        } else if (ref->complete_bitmap != nullptr) {
+            memcpy(bitmap_result, ref->complete_bitmap, len);
+        } else if (const uint8_t *cached = resident_reference(ref)) {
+            ref->reference_reads.fetch_add(1, std::memory_order_relaxed);
+            memcpy(bitmap_result, cached, len);
+        } else {
+            ref->reference_reads.fetch_add(1, std::memory_order_relaxed);
+            std::vector<uint8_t> full(ref->capacity);
+            materialize_reference(ref, full.data(), trace);
+            memcpy(bitmap_result, full.data(), len);
+        }
+    }
+
+    /**
+     * The reference of ref if it is held in full, else null with its
+     * delta stored to *delta.  A group that loses its delta gets its
+     * permanent cached copy first.
+     */
+    static const uint8_t *resident_reference(const BitmapRef *ref,
+                                             const ReferenceDelta **delta = nullptr) {
+        if (ref->complete_bitmap != nullptr) return ref->complete_bitmap;
+        const uint8_t *cached = ref->cached_reference.load(std::memory_order_acquire);
+        if (cached != nullptr) return cached;
+        const ReferenceDelta *d = ref->reference_delta.load(std::memory_order_acquire);
+        if (d == nullptr) return ref->cached_reference.load(std::memory_order_acquire);
+        if (delta != nullptr) *delta = d;
+        return nullptr;
+    }
+
+    /**
+     * Write the capacity bytes of ref's reference: the nearest full
+     * reference down its delta chain plus the deltas above it.  Pins an
+     * epoch, as GC may drop cached copies along the chain meanwhile.
+     */
+    void materialize_reference(const BitmapRef *ref, uint8_t *out, ReadTrace *trace = nullptr) {
+        EpochGuard guard(reclaimer);
+        std::vector<const ReferenceDelta *> chain;
+        const ReferenceDelta *delta = nullptr;
+        const uint8_t *full = resident_reference(ref, &delta);
+        while (full == nullptr) {
+            chain.push_back(delta);
+            full = resident_reference(delta->base, &delta);
+        }
+        memcpy(out, full, ref->capacity);
+        size_t bytes = ref->capacity;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            bytes += apply_diff(out, (*it)->diff);
+        }
+        if (trace != nullptr) trace->reference_bytes += bytes;
+    }
+
+    /**
+     * The full reference of ref for encoding against it, materialized
+     * into scratch if it is not held in memory.
+     */
+    const uint8_t *reference_data(BitmapRef *ref, std::vector<uint8_t> &scratch) {
+        const uint8_t *full = resident_reference(ref);
+        if (full != nullptr) return full;
+        scratch.resize(ref->capacity);
+        materialize_reference(ref, scratch.data());
+        return scratch.data();
+    }
+
+    /**
+     * Walk a group's change matrix once and flip the changed rows of
+     * every slot in slot_mask; results[i] belongs to the i-th lowest
+     * slot in slot_mask.  Returns the number of rows walked.
+     */
+    static uint32_t apply_matrix(BitmapRef *ref, uint64_t slot_mask, uint8_t *const *results) {
+        const MatrixBlock *block = ref->matrix.load(std::memory_order_acquire);
+        if (block == nullptr) return 0;
+        int slot_result[MAX_MATRIX_VERSIONS];
+        int k = 0;
+        for (int slot = 0; slot < MAX_MATRIX_VERSIONS; slot++) {
+            if (slot_mask & (1ull << slot)) slot_result[slot] = k++;
+        }
+        uint32_t len = block->len.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < len; i++) {
+            uint64_t m = block->masks[i].load(std::memory_order_relaxed) & slot_mask;
+            if (m == 0) continue;
+            int pos = block->rows[i];
+            uint8_t bit = 1 << (7 - pos % 8);
+            while (m != 0) {
+                int slot = __builtin_ctzll(m);
+                results[slot_result[slot]][pos / 8] ^= bit;
+                m &= m - 1;
+            }
+        }
+        return len;
+    }
+
+    static uint32_t log_prefix(const DiffView &diff) {
+        return diff.data[0] | ((uint32_t)diff.data[1] << 16);
+    }
+
+    /**
+     * Report the logical length of a reconstructed version, or pad it
+     * with zeros to BITMAP_SIZE for callers that expect full bitmaps.
+     */
+    static void finish_read(uint8_t *bitmap_result, int length, int *bitmap_len) {
+        if (bitmap_len != nullptr) {
+            *bitmap_len = length;
+        } else if (length < BITMAP_SIZE) {
+            memset(bitmap_result + length, 0, BITMAP_SIZE - length);
+        }
+    }
+
+    /**
+     * Locate and reconstruct a bitmap version visible to a given CSN.
+     * With bitmap_len only the valid prefix is written and its length
+     * returned; otherwise the result is zero-padded to BITMAP_SIZE.
+     */
+    bool get_bitmap(int require_csn, uint8_t *bitmap_result, int *bitmap_len = nullptr) {
+        EpochGuard guard(reclaimer);
+        BitmapRef *temp_refp = read_start(require_csn);
+        int hops = 0;
+
+        while (temp_refp != nullptr) {
+            if (require_csn < temp_refp->csn_range.first) {
+                temp_refp = temp_refp->next_ref.load();
+                hops++;
+            } else if (require_csn > temp_refp->csn_range.second) {
+                return false;
+            } else {
+                break;
+            }
+        }
+        if (temp_refp == nullptr) return false;
+
+        CompressedBitmap *temp_compressed_bitmap =
+            node_at(temp_refp->first_compressed_bitmap.load());
+
+        while (temp_compressed_bitmap != nullptr) {
+            if (require_csn == temp_compressed_bitmap->bitmap_csn) {
+                DiffView diff = temp_compressed_bitmap->load_diff();
+                reconstruct(bitmap_result, temp_refp, diff);
+                assist_read(temp_refp, temp_compressed_bitmap, diff, bitmap_result, hops);
+                finish_read(bitmap_result, diff.length, bitmap_len);
+                return true;
+            }
+            temp_compressed_bitmap = node_at(temp_compressed_bitmap->next_bitmap.load());
+        }
+        return false;
+    }
+
+    /**
+     * Reconstruct several versions at once.  Versions of a matrix group
+     * share one walk over its change matrix.  results[i] receives CSN
+     * csns[i], zero-padded to BITMAP_SIZE; found[i] reports success, and
+     * is false for versions still being inserted.
+     * Returns the number of versions found.
+     */
+    int get_bitmaps(const std::vector<int> &csns,
+                    const std::vector<uint8_t *> &results,
+                    std::vector<bool> &found) {
+        qos.admit_analytic((int)csns.size());
+        EpochGuard guard(reclaimer);
+        found.assign(csns.size(), false);
+        int found_cnt = 0;
+        std::vector<std::pair<int, size_t>> order;
+        for (size_t i = 0; i < csns.size(); i++) order.emplace_back(csns[i], i);
+        std::sort(order.begin(), order.end(), std::greater<std::pair<int, size_t>>());
+
+        BitmapRef *ref = first_ref.load();
+        size_t k = 0;
+        while (k < order.size() && ref != nullptr) {
+            if (order[k].first > ref->csn_range.second) {
+                k++;
+                continue;
+            }
+            if (order[k].first < ref->csn_range.first) {
+                ref = ref->next_ref.load();
+                continue;
+            }
+            uint64_t slot_mask = 0;
+            uint8_t *slot_results[MAX_MATRIX_VERSIONS];
+            int slot_len[MAX_MATRIX_VERSIONS];
+            CompressedBitmap *node = node_at(ref->first_compressed_bitmap.load());
+            for (; k < order.size() && order[k].first >= ref->csn_range.first; k++) {
+                while (node != nullptr && node->bitmap_csn > order[k].first) {
+                    node = node_at(node->next_bitmap.load());
+                }
+                if (node == nullptr || node->bitmap_csn != order[k].first ||
+                    !node->is_ready()) {
+                    continue;
+                }
+                uint8_t *result = results[order[k].second];
+                DiffView diff = node->load_diff();
+                if (diff.encoding == ENC_MATRIX && !(slot_mask & (1ull << diff.data[0]))) {
+                    copy_reference(result, ref, diff.length);
+                    slot_mask |= 1ull << diff.data[0];
+                    slot_results[diff.data[0]] = result;
+                    slot_len[diff.data[0]] = diff.length;
+                } else {
+                    reconstruct(result, ref, diff);
+                    finish_read(result, diff.length, nullptr);
+                }
+                found[order[k].second] = true;
+                found_cnt++;
+            }
+            if (slot_mask != 0) {
+                uint8_t *packed[MAX_MATRIX_VERSIONS];
+                int n = 0;
+                for (uint64_t m = slot_mask; m != 0; m &= m - 1) {
+                    packed[n++] = slot_results[__builtin_ctzll(m)];
+                }
+                apply_matrix(ref, slot_mask, packed);
+                for (uint64_t m = slot_mask; m != 0; m &= m - 1) {
+                    int slot = __builtin_ctzll(m);
+                    finish_read(slot_results[slot], slot_len[slot], nullptr);
+                }
+            }
+            ref = ref->next_ref.load();
+        }
+        return found_cnt;
+    }
+
+    /**
+     * Reconstruct the bitmap as of a wall-clock time (microseconds since
+     * the epoch), resolved through the time-to-CSN index.
+     */
+    bool get_bitmap_at_time(int64_t ts_us, uint8_t *bitmap_result,
+                            int *bitmap_len = nullptr) {
+        int csn = 0;
+        if (!resolve_csn_at_time(ts_us, csn)) return false;
+        qos.admit_analytic(1);
+        return get_bitmap_as_of(csn, bitmap_result, bitmap_len);
+    }
+
+    /**
+     * Reconstruct the newest retained version with CSN <= require_csn.
+     * Unlike get_bitmap this tolerates versions thinned out by retention.
+     * Fails if that version is still a placeholder.  With trace, what the
+     * read touched is recorded for comparison with estimate_read_cost.
+     */
+    bool get_bitmap_as_of(int require_csn, uint8_t *bitmap_result,
+                          int *bitmap_len = nullptr, ReadTrace *trace = nullptr) {
+        EpochGuard guard(reclaimer);
+        BitmapRef *temp_refp = read_start(require_csn);
+        int hops = 0;
+        while (temp_refp != nullptr && require_csn < temp_refp->csn_range.first) {
+            temp_refp = temp_refp->next_ref.load();
+            hops++;
+        }
+        while (temp_refp != nullptr) {
+            CompressedBitmap *node = node_at(temp_refp->first_compressed_bitmap.load());
+            while (node != nullptr && node->bitmap_csn > require_csn) {
+                node = node_at(node->next_bitmap.load());
+            }
+            if (node != nullptr) {
+                if (!node->is_ready()) return false;
+                DiffView diff = node->load_diff();
+                if (trace != nullptr) trace->version_csn = node->bitmap_csn;
+                reconstruct(bitmap_result, temp_refp, diff, trace);
+                assist_read(temp_refp, node, diff, bitmap_result, hops);
+                finish_read(bitmap_result, diff.length, bitmap_len);
+                return true;
+            }
+            temp_refp = temp_refp->next_ref.load();
+            hops++;
+        }
+        return false;
+    }
+
+    /**
+     * Zero-copy read of version require_csn when it equals its group
+     * reference (an empty diff) and references are interned.  Returns
+     * false otherwise; the caller then falls back to get_bitmap.
+     * The view holds the logical length and no zero padding.
+     */
+    bool get_bitmap_view(int require_csn, ReferenceView &view) {
+        EpochGuard guard(reclaimer);
+        BitmapRef *ref = read_start(require_csn);
+        while (ref != nullptr && require_csn < ref->csn_range.first) {
+            ref = ref->next_ref.load();
+        }
+        if (ref == nullptr || require_csn > ref->csn_range.second || !ref->interned) return false;
+        CompressedBitmap *node = node_at(ref->first_compressed_bitmap.load());
+        while (node != nullptr && node->bitmap_csn > require_csn) {
+            node = node_at(node->next_bitmap.load());
+        }
+        if (node == nullptr || node->bitmap_csn != require_csn || !node->is_ready()) return false;
+        DiffView diff = node->load_diff();
+        if (diff.encoding != ENC_SPARSE || diff.data[0] != 0 || diff.length > ref->capacity) {
+            return false;
+        }
+        ReferencePool::instance().acquire(ref->complete_bitmap);
+        view.assign(ref->complete_bitmap, diff.length);
+        return true;
+    }
+
+    /**
+     * Estimate the cost of get_bitmap_as_of(require_csn) by walking the
+     * same path without reconstructing.  Lock-free like the read itself.
+     */
+    ReadCostEstimate estimate_read_cost(int require_csn) {
+        EpochGuard guard(reclaimer);
+        ReadCostEstimate estimate;
+        BitmapRef *ref = read_start(require_csn);
+        while (ref != nullptr && require_csn < ref->csn_range.first) {
+            ref = ref->next_ref.load();
+            estimate.groups_walked++;
+        }
+        for (; ref != nullptr; ref = ref->next_ref.load(), estimate.groups_walked++) {
+            CompressedBitmap *node = node_at(ref->first_compressed_bitmap.load());
+            while (node != nullptr && node->bitmap_csn > require_csn) {
+                node = node_at(node->next_bitmap.load());
+                estimate.versions_walked++;
+            }
+            if (node == nullptr) continue;
+
+            estimate.found = true;
+            estimate.ready = node->is_ready();
+            estimate.version_csn = node->bitmap_csn;
+            estimate.group_csn = ref->csn_range.first;
+            if (!estimate.ready) return estimate;
+            DiffView diff = node->load_diff();
+            estimate.encoding = diff.encoding;
+            estimate.bitmap_len = diff.length;
+            estimate.diff_bytes = applied_diff_bytes(ref, diff);
+            estimate.bytes_touched = reference_read_bytes(ref, diff.length) + estimate.diff_bytes;
+            estimate.reference_copy = estimate.diff_bytes == 0;
+            return estimate;
+        }
+        return estimate;
+    }
+
+    /**
+     * Bytes a read copies or decodes to produce len bytes of ref's
+     * reference, including the delta chain of a reference held as a diff.
+     */
+    static size_t reference_read_bytes(const BitmapRef *ref, int len) {
+        if (ref->fill != FILL_NONE) return len;
+        size_t bytes = 0;
+        const ReferenceDelta *delta = nullptr;
+        while (resident_reference(ref, &delta) == nullptr) {
+            bytes += diff_bytes(delta->diff);
+            ref = delta->base;
+        }
+        return bytes + (bytes == 0 ? len : ref->capacity);
+    }
+
+    /**
+     * Branch the version history.  The returned controller shares every
+     * sealed group with this one through a reference count, so forking
+     * costs a copy of the two newest groups plus anything still pending.
+     * Copies keep only published versions.  Later commits on either side
+     * go to private groups; shared groups stay immutable, and GC skips
+     * them, until the other side releases them.  Reservations and new
+     * groups wait while the group list is copied; the copy's workers
+     * start only once it is fully wired.
+     */
+    std::unique_ptr<BitmapController> fork() {
+        std::lock_guard<std::mutex> gc_guard(gc_lock);
+        EpochGuard guard(reclaimer);
+        std::unique_ptr<BitmapController> forked(
+            new BitmapController(tsn_list, config, DeferWorkers()));
+        forked->arena = arena;
+
+        std::lock_guard<SiteLock<std::mutex>> cnt_guard(head_bitmap_cnt_lock);
+        std::lock_guard<SiteLock<std::mutex>> head_guard(head_lock);
+        forked->time_index.copy_from(time_index);
+
+        // Share the longest suffix of sealed groups, past the two newest
+        // (the same groups GC leaves alone).  Pending counts of non-head
+        // groups only go down, so the boundary stays valid.
+        std::vector<BitmapRef *> groups;
+        for (BitmapRef *ref = first_ref.load(); ref != nullptr; ref = ref->next_ref.load()) {
+            groups.push_back(ref);
+        }
+        size_t shared_from = std::min<size_t>(2, groups.size());
+        for (size_t i = shared_from; i < groups.size(); i++) {
+            std::lock_guard<SiteLock<std::mutex>> lk(groups[i]->ref_lock);
+            if (groups[i]->pending_cnt > 0) shared_from = i + 1;
+        }
+
+        BitmapRef *shared = shared_from < groups.size() ? groups[shared_from] : nullptr;
+        for (size_t i = shared_from; i < groups.size(); i++) {
+            groups[i]->share_cnt.fetch_add(1);
+        }
+        BitmapRef *older = shared;
+        for (size_t i = shared_from; i-- > 0;) {
+            BitmapRef *copy = forked->copy_group(groups[i]);
+            copy->next_ref.store(older);
+            older = copy;
+            if (i == 0) {
+                forked->head_bitmap_cnt = copy->bitmap_cnt;
+                forked->head_capacity = copy->capacity;
+            }
+        }
+        forked->first_ref.store(older);
+        if (older != nullptr) {
+            forked->high_water_csn.store(older->csn_range.second);
+            forked->visible_csn.store(older->csn_range.second);
+            forked->visible_tail_us.store(wall_clock_us());
+            forked->visible_tail_csn.store(older->csn_range.second);
+        }
+        forked->start_workers();
+        return forked;
+    }
+
+    /**
+     * Checkpoint image of the group list, newest group first.  Returns the
+     * fingerprint of every group with a published version; the groups
+     * that changed accepts are also written to sink as log records that
+     * replay_log_record rebuilds: LOG_GROUP with the reference, LOG_DROP
+     * if GC removed the group's first version, then one LOG_VERSION per
+     * published version.  Delete-log, matrix and position tree versions
+     * are re-encoded as regular diffs, as in copy_group.  Runs under the GC lock, so the
+     * group list is stable, and locks one group at a time.
+     */
+    std::vector<GroupFingerprint> export_groups(
+        const std::function<bool(const GroupFingerprint &)> &changed, const DiffLogSink &sink) {
+        std::lock_guard<std::mutex> gc_guard(gc_lock);
+        EpochGuard guard(reclaimer);
+        std::vector<GroupFingerprint> groups;
+        std::vector<CompressedBitmap *> nodes;
+        std::vector<uint8_t> scratch;
+        std::vector<uint8_t> buf;
+        for (BitmapRef *ref = first_ref.load(); ref != nullptr; ref = ref->next_ref.load()) {
+            std::lock_guard<SiteLock<std::mutex>> lk(ref->ref_lock);
+            nodes.clear();
+            for (CompressedBitmap *node = node_at(ref->first_compressed_bitmap.load());
+                 node != nullptr; node = node_at(node->next_bitmap.load())) {
+                if (node->is_ready()) nodes.push_back(node);
+            }
+            if (nodes.empty()) continue;
+
+            GroupFingerprint group;
+            group.group_csn = ref->csn_range.first;
+            group.published_csn = nodes.front()->bitmap_csn;
+            group.versions = (int)nodes.size();
+            uint64_t h = 0xcbf29ce484222325ull ^ (uint64_t)ref->bitmap_len;
+            for (CompressedBitmap *node : nodes) {
+                h = (h ^ (uint32_t)node->bitmap_csn) * 0x100000001b3ull;
+                h ^= h >> 29;
+            }
+            group.fingerprint = h;
+            groups.push_back(group);
+            if (!changed(group)) continue;
+
+            const uint8_t *reference = reference_data(ref, scratch);
+            DiffLogRecord record;
+            record.header.type = LOG_GROUP;
+            record.header.csn = group.group_csn;
+            record.header.group_csn = group.group_csn;
+            record.header.published_csn = group.group_csn;
+            record.header.high_water_csn = group.published_csn;
+            record.header.bitmap_len = ref->bitmap_len;
+            record.header.payload_bytes = ref->bitmap_len;
+            record.payload = reference;
+            sink(record);
+            if (nodes.back()->bitmap_csn != group.group_csn) {
+                record.header.type = LOG_DROP;
+                record.header.payload_bytes = 0;
+                record.payload = nullptr;
+                sink(record);
+            }
+            for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+                if ((*it)->bitmap_csn == group.group_csn) continue;
+                DiffView diff = (*it)->load_diff();
+                bool reencoded = diff.encoding == ENC_LOG || diff.encoding == ENC_MATRIX ||
+                                 diff.encoding == ENC_PTREE;
+                if (reencoded) {
+                    buf.resize(BITMAP_SIZE);
+                    reconstruct(buf.data(), ref, diff);
+                    diff = compress_bitmap(buf.data(), diff.length, reference);
+                }
+                record.header.type = LOG_VERSION;
+                record.header.csn = (*it)->bitmap_csn;
+                record.header.published_csn = (*it)->bitmap_csn;
+                record.header.encoding = diff.encoding;
+                record.header.bitmap_len = diff.length;
+                record.header.payload_bytes = diff_bytes(diff);
+                record.payload = diff.data;
+                sink(record);
+                if (reencoded) delete[] diff.data;
+            }
+        }
+        return groups;
+    }
+
+    /**
+     * Prepare a controller rebuilt with replay_log_record for commits.
+     * The next commit starts a new group, so replayed groups stay as
+     * they were shipped.
+     */
+    void resume_commits() {
+        std::lock_guard<SiteLock<std::mutex>> lk(head_bitmap_cnt_lock);
+        head_bitmap_cnt = config.group_versions;
+        BitmapRef *head = first_ref.load();
+        head_capacity = head != nullptr ? head->capacity : 0;
+    }
+
+    /**
+     * Run one garbage collection pass under the retention policy.
+     * Versions whose CSN is in active_snapshots are always kept, as are
+     * the two newest groups, groups with unpublished versions and groups
+     * shared with a fork.
+     * Returns the bytes freed, including memory retired earlier.
+     */
+    size_t collect_garbage(int64_t now_us, std::vector<int> active_snapshots) {
+        std::lock_guard<std::mutex> gc_guard(gc_lock);
+        std::sort(active_snapshots.begin(), active_snapshots.end());
+
+        std::vector<GcVersion> versions;
+        BitmapRef *ref = first_ref.load();
+        for (int skip = 0; skip < 2 && ref != nullptr; skip++) {
+            ref = ref->next_ref.load();
+        }
+        for (; ref != nullptr; ref = ref->next_ref.load()) {
+            qos.background_yield();
+            std::lock_guard<SiteLock<std::mutex>> lk(ref->ref_lock);
+            if (ref->pending_cnt > 0 || ref->share_cnt.load() > 1) continue;
+            refresh_reference_cache(ref);
+            for (CompressedBitmap *node = node_at(ref->first_compressed_bitmap.load());
+                 node != nullptr; node = node_at(node->next_bitmap.load())) {
+                GcVersion v;
+                v.ref = ref;
+                v.node = node;
+                v.has_time = time_index.time_of(node->bitmap_csn, v.ts_us);
+                v.pinned = std::binary_search(active_snapshots.begin(),
+                                              active_snapshots.end(),
+                                              node->bitmap_csn);
+                v.bytes = sizeof(CompressedBitmap) + diff_bytes(node->load_diff());
+                versions.push_back(v);
+            }
+        }
+
+        int64_t horizon_us = now_us - config.retention_horizon_us;
+        int64_t granularity = config.retention_granularity_us;
+        while (true) {
+            size_t freed = plan_retention(versions, horizon_us, granularity);
+            if (config.memory_budget_bytes == 0 || granularity == 0 ||
+                charged_bytes() - freed <= config.memory_budget_bytes ||
+                versions.empty() || granularity > now_us - versions.back().ts_us) {
+                break;
+            }
+            granularity *= 2;
+        }
+        apply_retention(versions);
+
+        if (granularity > 0) {
+            time_index.thin(horizon_us, granularity);
+        }
+        gc_runs.fetch_add(1);
+        size_t freed = reclaimer.reclaim();
+        memory_bytes.fetch_sub(freed);
+        return freed;
+    }
+
+    /**
+     * CSNs of every filled version still retained, ascending.
+     */
+    std::vector<int> get_retained_csns() {
+        EpochGuard guard(reclaimer);
+        std::vector<int> csns;
+        for (BitmapRef *ref = first_ref.load(); ref != nullptr; ref = ref->next_ref.load()) {
+            for (CompressedBitmap *node = node_at(ref->first_compressed_bitmap.load());
+                 node != nullptr; node = node_at(node->next_bitmap.load())) {
+                if (node->is_ready()) csns.push_back(node->bitmap_csn);
+            }
+        }
+        std::sort(csns.begin(), csns.end());
+        return csns;
+    }
+
+    /**
+     * Newest CSN whose whole prefix was visible at or before a
+     * wall-clock time.  Times past the newest visibility advance resolve
+     * to the visible watermark; older ones go to the index, which is
+     * sampled once per granularity bucket.
+     */
+    bool resolve_csn_at_time(int64_t ts_us, int &csn) {
+        int tail_csn = visible_tail_csn.load(std::memory_order_acquire);
+        if (tail_csn >= 0 && ts_us >= visible_tail_us.load(std::memory_order_acquire)) {
+            csn = tail_csn;
+            return true;
+        }
+        return time_index.lookup(ts_us, csn);
+    }
+
+    /**
+     * Stage 1: insert a placeholder bitmap version.
+     * The placeholder reserves the correct position in the version chain.
+     * bitmap_len is the logical length in bytes; a version that outgrows
+     * the head group's reference capacity starts a new group.
+     */
+    bool insert_null(int new_csn,
+                     uint8_t *original_bitmap,
+                     BitmapRef *&ref,
+                     CompressedBitmap *&bitmap,
+                     int bitmap_len = BITMAP_SIZE) {
+        uint64_t ts = now_ns();
+        EpochGuard guard(reclaimer);
+        bool create_ref = false;
+        BitmapRef *now_first_ref = nullptr;
+
+        head_bitmap_cnt_lock.lock();
+        if (head_bitmap_cnt >= config.group_versions || bitmap_len > head_capacity) {
+            head_bitmap_cnt = 1;
+            head_capacity = bitmap_capacity(bitmap_len);
+            create_ref = true;
+        } else {
+            head_bitmap_cnt++;
+            now_first_ref = first_ref.load();
+            head_bitmap_cnt_lock.unlock();
+        }
+
+        if (create_ref) {
+            // Keep head_bitmap_cnt_lock until the group is linked: a
+            // reservation that saw the new count and capacity with the old
+            // head group would diff against a too small reference.
+            BitmapRef *new_ref = new_group(new_csn, original_bitmap, bitmap_len);
+
+            head_lock.lock();
+            new_ref->next_ref = first_ref.load();
+            first_ref.store(new_ref);
+            if (log_sink) {
+                DiffLogRecord record;
+                record.header.type = LOG_GROUP;
+                record.header.csn = new_csn;
+                record.header.group_csn = new_csn;
+                record.header.published_csn = new_csn;
+                record.header.high_water_csn = std::max(high_water_csn.load(), new_csn);
+                record.header.bitmap_len = bitmap_len;
+                record.header.payload_bytes = bitmap_len;
+                record.payload = original_bitmap;
+                emit_log(record);
+            }
+            raise_high_water(new_csn);
+            head_lock.unlock();
+            head_bitmap_cnt_lock.unlock();
+            if (config.delta_references) {
+                // The group leaving the two newest no longer serves commits.
+                BitmapRef *older = new_ref->next_ref.load();
+                if (older != nullptr) older = older->next_ref.load();
+                if (older != nullptr) {
+                    std::lock_guard<SiteLock<std::mutex>> lk(older->ref_lock);
+                    refresh_reference_cache(older);
+                }
+            }
+
+            record_stage(STAGE_RESERVE, ts);
+            return true;
+        }
+
+        NodeOffset new_offset = arena->alloc();
+        CompressedBitmap *new_compressed_bitmap = arena->at(new_offset);
+        new_compressed_bitmap->bitmap_csn = new_csn;
+
+        account_memory(sizeof(CompressedBitmap));
+
+        now_first_ref->ref_lock.lock();
+        new_compressed_bitmap->next_bitmap =
+            now_first_ref->first_compressed_bitmap.load();
+        now_first_ref->first_compressed_bitmap.store(new_offset);
+        now_first_ref->pending_cnt++;
+        pending_versions.fetch_add(1, std::memory_order_relaxed);
+        now_first_ref->ref_lock.unlock();
+        note_reserved(new_csn);
+
+        ref = now_first_ref;
+        bitmap = new_compressed_bitmap;
+        record_stage(STAGE_RESERVE, ts);
+        return true;
+    }
+
+    /**
+     * Stage 2 & 3: fill placeholder and update visibility range.
+     * Runs the DIFF, LINK, CONSOLIDATE and PUBLISH stages inline.
+     */
+    bool insert_bitmap_content(BitmapRef *ref,
+                               CompressedBitmap *bitmap,
+                               uint8_t *original_bitmap,
+                               int bitmap_len = BITMAP_SIZE) {
+        uint64_t ts = now_ns();
+        DiffView diff = stage_diff(ref, original_bitmap, bitmap_len);
+        stage_link(bitmap, diff);
+        stage_consolidate_and_publish(ref, bitmap);
+        qos.record_commit((int64_t)(now_ns() - ts));
+        return true;
+    }
+
+    /**
+     * Pipelined variant of insert_bitmap_content.
+     * The committing thread only stages a copy of the bitmap and enqueues it;
+     * DIFF..PUBLISH run on the pipeline workers.  Falls back to the inline
+     * path when the pipeline is not running.
+     */
+    bool submit_bitmap_content(BitmapRef *ref,
+                               CompressedBitmap *bitmap,
+                               uint8_t *original_bitmap,
+                               int bitmap_len = BITMAP_SIZE) {
+        if (!pipeline_running.load()) {
+            return insert_bitmap_content(ref, bitmap, original_bitmap, bitmap_len);
+        }
+        CommitJob job;
+        job.ref = ref;
+        job.bitmap = bitmap;
+        job.staged_bitmap = new uint8_t[bitmap_len];
+        job.bitmap_len = bitmap_len;
+        job.submit_ns = now_ns();
+        memcpy(job.staged_bitmap, original_bitmap, bitmap_len);
+
+        pipeline_submitted.fetch_add(1);
+        while (!diff_queue->try_push(job)) {
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    /**
+     * Block until every submitted commit has been published.
+     */
+    void drain_pipeline() {
+        while (pipeline_completed.load() < pipeline_submitted.load()) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Install a sink that receives every group creation and version
+     * publication, in the order they take effect.  Must be set before
+     * the first insert.  The sink is called under the group locks.
+     */
+    void set_log_sink(const DiffLogSink &sink) {
+        log_sink = sink;
+    }
+
+    /**
+     * Highest CSN published so far.
+     */
+    int get_high_water_csn() const {
+        return high_water_csn.load();
+    }
+
+    /**
+     * Highest CSN up to which every reserved version is published, so a
+     * read at or below it never meets a placeholder.
+     */
+    int get_visible_csn() const {
+        return visible_csn.load();
+    }
+
+    /**
+     * Block until every version up to csn is published, e.g. to read a
+     * session's own last commit, or until timeout_us passes (negative
+     * waits without limit).  Returns whether csn became visible.
+     * Waiters sleep on a futex on the visible CSN, woken by the publish
+     * that advances it.
+     */
+    bool wait_for_csn(int csn, int64_t timeout_us = -1) {
+        if (visible_csn.load() >= csn) return true;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+        csn_waits.fetch_add(1, std::memory_order_relaxed);
+        csn_waiters.fetch_add(1);
+        bool visible = false;
+        while (true) {
+            int seen = visible_csn.load();
+            if (seen >= csn) {
+                visible = true;
+                break;
+            }
+            struct timespec timeout;
+            struct timespec *timeout_ptr = nullptr;
+            if (timeout_us >= 0) {
+                int64_t remaining_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+                if (remaining_ns <= 0) break;
+                timeout.tv_sec = remaining_ns / 1000000000;
+                timeout.tv_nsec = remaining_ns % 1000000000;
+                timeout_ptr = &timeout;
+            }
+            syscall(SYS_futex, reinterpret_cast<int *>(&visible_csn), FUTEX_WAIT_PRIVATE,
+                    seen, timeout_ptr, nullptr, 0);
+        }
+        csn_waiters.fetch_sub(1);
+        return visible;
+    }
+
+    /**
+     * Load a CSN-ordered version sequence in one go.
+     * The sequence is partitioned into groups up front, each group's
+     * reference and cumulative diffs are built by worker threads without
+     * locking, and the finished groups are published with one store of the
+     * group list head.  CSNs must be newer than every version already in
+     * the controller, and no commit may run concurrently.
+     * Versions carrying commit_ts_us are sampled into the time index at
+     * that time; the others are all stamped with the load time, so time
+     * travel reads before the load only see versions with a timestamp.
+     * Returns false, leaving the controller unchanged, on invalid input.
+     */
+    bool bulk_load(const std::vector<BulkVersion> &versions, int threads = 0) {
+        if (versions.empty()) return true;
+        if (versions[0].bitmap == nullptr) return false;
+        for (size_t i = 0; i < versions.size(); i++) {
+            const BulkVersion &v = versions[i];
+            if (v.bitmap_len <= 0 || v.bitmap_len > BITMAP_SIZE) return false;
+            if (i == 0 ? v.csn <= high_water_csn.load() : v.csn <= versions[i - 1].csn) return false;
+            if (v.bitmap == nullptr) {
+                if (v.delta == nullptr && v.delta_cnt > 0) return false;
+                for (int k = 0; k < v.delta_cnt; k++) {
+                    if (v.delta[k] >= v.bitmap_len * 8) return false;
+                }
+            }
+        }
+
+        // Partition into groups and materialize each group's reference.
+        std::vector<size_t> group_start;
+        std::vector<uint8_t *> group_bitmap;
+        std::vector<uint8_t> current(BITMAP_SIZE, 0);
+        int cnt = config.group_versions;
+        int capacity = 0;
+        for (size_t i = 0; i < versions.size(); i++) {
+            apply_bulk_version(current.data(), versions[i]);
+            if (cnt >= config.group_versions || versions[i].bitmap_len > capacity) {
+                cnt = 0;
+                capacity = bitmap_capacity(versions[i].bitmap_len);
+                group_start.push_back(i);
+                uint8_t *reference = new uint8_t[capacity]();
+                memcpy(reference, current.data(), versions[i].bitmap_len);
+                group_bitmap.push_back(reference);
+            }
+            cnt++;
+        }
+        group_start.push_back(versions.size());
+
+        // Build groups in parallel.
+        size_t group_num = group_bitmap.size();
+        std::vector<BitmapRef *> groups(group_num, nullptr);
+        std::atomic<size_t> next_group{0};
+        auto build = [&] {
+            std::vector<uint8_t> local(BITMAP_SIZE);
+            size_t g;
+            while ((g = next_group.fetch_add(1)) < group_num) {
+                groups[g] = build_bulk_group(versions, group_start[g], group_start[g + 1],
+                                             group_bitmap[g], local.data());
+            }
+        };
+        if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = (int)std::min<size_t>(threads, group_num);
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++) workers.emplace_back(build);
+        build();
+        for (auto &t : workers) t.join();
+
+        // Publish oldest to newest in a single head store.
+        for (size_t g = 1; g < group_num; g++) {
+            groups[g]->next_ref.store(groups[g - 1]);
+        }
+        head_lock.lock();
+        groups[0]->next_ref.store(first_ref.load());
+        first_ref.store(groups[group_num - 1]);
+        head_lock.unlock();
+
+        head_bitmap_cnt_lock.lock();
+        head_bitmap_cnt = groups[group_num - 1]->bitmap_cnt;
+        head_capacity = groups[group_num - 1]->capacity;
+        head_bitmap_cnt_lock.unlock();
+        for (const BulkVersion &v : versions) {
+            if (v.commit_ts_us > 0) time_index.record(v.commit_ts_us, v.csn);
+        }
+        if (log_sink) {
+            for (BitmapRef *ref : groups) log_bulk_group(ref, versions.back().csn);
+        }
+        raise_high_water(versions.back().csn);
+        return true;
+    }
+
+    /**
+     * Apply a record produced by another controller's log sink.
+     * Groups and versions are rebuilt from the shipped encodings and the
+     * primary's union cascade and visible ranges are replayed verbatim.
+     */
+    bool replay_log_record(const DiffLogRecord &record) {
+        EpochGuard guard(reclaimer);
+        const DiffLogHeader &hdr = record.header;
+        if (hdr.type == LOG_GROUP) {
+            BitmapRef *new_ref = new_group(hdr.csn, static_cast<const uint8_t *>(record.payload),
+                                           hdr.payload_bytes);
+
+            head_lock.lock();
+            std::atomic<BitmapRef*> *link = &first_ref;
+            while (link->load() != nullptr &&
+                   link->load()->csn_range.first > hdr.csn) {
+                link = &link->load()->next_ref;
+            }
+            new_ref->next_ref = link->load();
+            link->store(new_ref);
+            head_lock.unlock();
+        } else if (hdr.type == LOG_VERSION) {
+            BitmapRef *ref = first_ref.load();
+            while (ref != nullptr && ref->csn_range.first != hdr.group_csn) {
+                ref = ref->next_ref.load();
+            }
+            if (ref == nullptr) return false;
+
+            NodeOffset offset = arena->alloc();
+            CompressedBitmap *bitmap = arena->at(offset);
+            bitmap->bitmap_csn = hdr.csn;
+            DiffView diff;
+            diff.data = new uint16_t[hdr.payload_bytes / sizeof(uint16_t)];
+            diff.encoding = static_cast<DiffEncoding>(hdr.encoding);
+            diff.length = hdr.bitmap_len;
+            memcpy(diff.data, record.payload, hdr.payload_bytes);
+            bitmap->set_diff(diff);
+            account_memory(sizeof(CompressedBitmap) + hdr.payload_bytes);
+
+            ref->ref_lock.lock();
+            std::atomic<NodeOffset> *link = &ref->first_compressed_bitmap;
+            while (link->load() != NULL_NODE &&
+                   node_at(link->load())->bitmap_csn > hdr.csn) {
+                link = &node_at(link->load())->next_bitmap;
+            }
+            bitmap->next_bitmap = link->load();
+            link->store(offset);
+            ref->bitmap_cnt++;
+
+            if (hdr.union_from_csn != -1) {
+                CompressedBitmap *temp_bmp = node_at(ref->first_compressed_bitmap.load());
+                while (temp_bmp != nullptr && temp_bmp->bitmap_csn != hdr.union_from_csn) {
+                    temp_bmp = node_at(temp_bmp->next_bitmap.load());
+                }
+                while (temp_bmp != nullptr && temp_bmp != bitmap) {
+                    union_into(temp_bmp, bitmap);
+                    temp_bmp = node_at(temp_bmp->next_bitmap.load());
+                }
+            }
+            ref->csn_range.second = std::max(ref->csn_range.second, hdr.published_csn);
+            ref->ref_lock.unlock();
+        } else if (hdr.type == LOG_DROP) {
+            BitmapRef *ref = first_ref.load();
+            while (ref != nullptr && ref->csn_range.first != hdr.group_csn) {
+                ref = ref->next_ref.load();
+            }
+            if (ref == nullptr) return false;
+            std::lock_guard<SiteLock<std::mutex>> lk(ref->ref_lock);
+            std::atomic<NodeOffset> *link = &ref->first_compressed_bitmap;
+            while (link->load() != NULL_NODE && node_at(link->load())->bitmap_csn != hdr.csn) {
+                link = &node_at(link->load())->next_bitmap;
+            }
+            if (link->load() == NULL_NODE) return false;
+            NodeOffset offset = link->load();
+            link->store(node_at(offset)->next_bitmap.load());
+            retire_node(offset);
+            ref->bitmap_cnt--;
+            return true;
+        }
+        raise_high_water(hdr.csn);
+        return true;
+    }
+
+    /**
+     * Current backpressure: how close memory, unreclaimed memory and
+     * unpublished commits are to their configured limits.
+     */
+    ControllerPressure get_pressure() const {
+        ControllerPressure pressure;
+        pressure.memory_bytes = charged_bytes();
+        pressure.memory_budget_bytes = config.memory_budget_bytes;
+        pressure.retired_bytes = reclaimer.get_retired_bytes();
+        pressure.retired_bytes_limit = config.retired_bytes_limit;
+        pressure.pending_versions = (size_t)std::max<int64_t>(0, pending_versions.load());
+        pressure.pending_versions_limit = config.pending_versions_limit;
+        auto ratio = [](size_t value, size_t limit) {
+            return limit == 0 ? 0.0 : (double)value / limit;
+        };
+        pressure.level = std::max({ratio(pressure.memory_bytes, pressure.memory_budget_bytes),
+                                   ratio(pressure.retired_bytes, pressure.retired_bytes_limit),
+                                   ratio(pressure.pending_versions,
+                                         pressure.pending_versions_limit)});
+        return pressure;
+    }
+
+    /**
+     * Admission control, called by a committing thread before insert_null
+     * and without holding the CSN lock.  Below the soft pressure this
+     * returns at once.  Above it the commit is delayed linearly in the
+     * excess, up to admission_max_delay_us; at full pressure the caller
+     * helps reclaim retired memory and waits in such slices until pressure
+     * drops or admission_max_wait_ms has passed, so overload shows up as
+     * commit latency rather than unbounded memory.  Returns the delay in
+     * microseconds.
+     */
+    int64_t admit_commit() {
+        if (config.admission_max_delay_us <= 0) return 0;
+        ControllerPressure pressure = get_pressure();
+        double soft = std::min(config.admission_soft_pressure, 0.99);
+        if (pressure.level <= soft) return 0;
+
+        uint64_t start = now_ns();
+        int64_t max_wait_ns = (int64_t)config.admission_max_wait_ms * 1000000;
+        while (true) {
+            if (pressure.retired_bytes > 0 && pressure.level >= 1) reclaimer.reclaim();
+            double excess = std::min(1.0, (pressure.level - soft) / (1.0 - soft));
+            std::this_thread::sleep_for(std::chrono::microseconds(
+                std::max<int64_t>(1, (int64_t)(excess * config.admission_max_delay_us))));
+            if ((int64_t)(now_ns() - start) >= max_wait_ns) break;
+            pressure = get_pressure();
+            if (pressure.level < 1) break;
+        }
+        int64_t delay_us = (int64_t)(now_ns() - start) / 1000;
+        admission_delayed.fetch_add(1, std::memory_order_relaxed);
+        admission_delay_us.fetch_add(delay_us, std::memory_order_relaxed);
+        return delay_us;
+    }
+
+    /**
+     * Collect controller counters.
+     */
+    ControllerStats get_stats() const {
+        ControllerStats stats;
+        for (int i = 0; i < STAGE_NUM; i++) {
+            stats.stage_count[i] = stage_count[i].load(std::memory_order_relaxed);
+            stats.stage_ns[i] = stage_ns[i].load(std::memory_order_relaxed);
+        }
+        stats.version_nodes = arena->live_nodes();
+        stats.version_node_bytes = stats.version_nodes * sizeof(CompressedBitmap);
+        stats.time_index_entries = time_index.size();
+        stats.memory_bytes = memory_bytes.load();
+        stats.retired_bytes = reclaimer.get_retired_bytes();
+        stats.gc_runs = gc_runs.load();
+        stats.gc_versions_freed = gc_versions_freed.load();
+        stats.gc_groups_freed = gc_groups_freed.load();
+        stats.log_versions = log_versions.load();
+        stats.ptree_versions = ptree_versions.load();
+        stats.ptree_positions = ptree_positions.load();
+        stats.ptree_nodes = ptree_nodes.load();
+        stats.log_fallbacks = log_fallbacks.load();
+        stats.matrix_versions = matrix_versions.load();
+        stats.read_hint_updates = read_hint_updates.load();
+        stats.reader_consolidations = reader_consolidations.load();
+        stats.admission_delayed = admission_delayed.load();
+        stats.csn_waits = csn_waits.load();
+        stats.csn_wakes = csn_wakes.load();
+        stats.delta_references = delta_reference_groups.load();
+        stats.reference_cache_fills = reference_cache_fills.load();
+        stats.reference_cache_drops = reference_cache_drops.load();
+        stats.reference_reanchors = reference_reanchors.load();
+        stats.admission_delay_us = admission_delay_us.load();
+        stats.reference_pool = ReferencePool::instance().get_stats();
+        stats.pipeline_submitted = pipeline_submitted.load();
+        stats.pipeline_completed = pipeline_completed.load();
+        if (diff_queue) stats.pipeline_diff_queue = diff_queue->size_approx();
+        if (publish_queue) stats.pipeline_publish_queue = publish_queue->size_approx();
+        stats.qos = qos.get_stats();
+        stats.lock_sites = collect_lock_profile();
+        return stats;
+    }
+
+  private:
+    struct DeferWorkers {};
+
+    /**
+     * Set up an empty controller without starting the GC and pipeline
+     * threads, so fork() can wire the copy up before anything runs on it.
+     */
+    BitmapController(std::vector<int>& tsn_list_ref, const ControllerConfig &config_ref,
+                     DeferWorkers)
+        : tsn_list(tsn_list_ref), stop_flag(false), config(config_ref),
+          time_index(config_ref.time_index_granularity_us),
+          qos(config_ref.commit_latency_target_ns, config_ref.analytic_overload_rate,
+              config_ref.max_background_delay_ms)
+    {
+        if (config.matrix_groups) {
+            config.group_versions = std::min(config.group_versions, MAX_MATRIX_VERSIONS);
+        }
+        config.group_versions = std::max(config.group_versions, 1);
+        head_bitmap_cnt = config.group_versions;
+    }
+
+    void start_workers() {
+        if (config.pipelined_commit) {
+            start_pipeline();
+        }
+        if (config.gc_interval_ms > 0) {
+            worker = std::thread([this] { gc_loop(); });
+        }
+    }
+
+    std::atomic<BitmapRef*> first_ref = nullptr;   // Head of reference chain
+    std::atomic<BitmapRef*> read_hint{nullptr};    // Group a deep reader found last
+    SiteLock<std::mutex> head_lock{"head_lock"};
+    SiteLock<std::mutex> head_bitmap_cnt_lock{"head_bitmap_cnt_lock"};
+    int head_bitmap_cnt = 0;
+    int head_capacity = 0;                         // Reference capacity of the head group
+
+    std::thread worker;
+    std::vector<int>& tsn_list;
+    std::atomic<bool> stop_flag;
+    std::mutex mtx;
+
+    ControllerConfig config;
+    std::shared_ptr<NodeArena> arena = std::make_shared<NodeArena>(); // Version nodes, shared by forks
+    EpochReclaimer reclaimer;                              // Deferred frees for lock-free readers
+    TimeCsnIndex time_index;                               // Wall-clock to CSN samples
+    QosScheduler qos;                                      // Commit-latency driven pacing
+
+    CompressedBitmap *node_at(NodeOffset offset) const {
+        return arena->at(offset);
+    }
+
+    /**
+     * Allocate a group whose reference is a copy of bitmap, or a delta
+     * against the head group's one.  The group's first version is the
+     * reference itself, with an empty diff.
+     */
+    BitmapRef *new_group(int csn, const uint8_t *bitmap, int bitmap_len) {
+        BitmapRef *new_ref = new BitmapRef();
+        new_ref->csn_range.first = csn;
+        new_ref->csn_range.second = csn;
+        new_ref->bitmap_cnt++;
+        new_ref->bitmap_len = bitmap_len;
+        new_ref->capacity = bitmap_capacity(bitmap_len);
+        new_ref->log_tail_csn = csn;
+        uint8_t *reference = new uint8_t[new_ref->capacity];
+        memcpy(reference, bitmap, bitmap_len);
+        memset(reference + bitmap_len, 0, new_ref->capacity - bitmap_len);
+        if (!encode_reference_delta(new_ref, reference)) {
+            set_reference(new_ref, reference);
+        }
+
+        NodeOffset offset = arena->alloc();
+        CompressedBitmap *new_compressed_bitmap = arena->at(offset);
+        new_compressed_bitmap->bitmap_csn = csn;
+        DiffView empty_diff;
+        empty_diff.data = new uint16_t[1];
+        empty_diff.data[0] = 0;
+        empty_diff.length = bitmap_len;
+        new_compressed_bitmap->set_diff(empty_diff);
+        new_ref->first_compressed_bitmap.store(offset);
+        account_memory(sizeof(BitmapRef) + reference_bytes(new_ref) +
+                       sizeof(CompressedBitmap) + sizeof(uint16_t));
+        return new_ref;
+    }
+
+    /**
+     * Private copy of another controller's group holding its published
+     * versions.  Regular diffs are copied verbatim; delete-log, matrix and
+     * position tree versions are re-encoded as regular diffs against the
+     * copied reference.
+     * A delta reference is copied in full.
+     */
+    BitmapRef *copy_group(BitmapRef *src) {
+        BitmapRef *copy = new BitmapRef();
+        std::lock_guard<SiteLock<std::mutex>> lk(src->ref_lock);
+        copy->csn_range = src->csn_range;
+        copy->bitmap_len = src->bitmap_len;
+        copy->capacity = src->capacity;
+        copy->log_tail_csn = src->csn_range.first;
+        copy->fill = src->fill;
+        if (src->interned) {
+            ReferencePool::instance().acquire(src->complete_bitmap);
+            copy->complete_bitmap = src->complete_bitmap;
+            copy->interned = true;
+        } else {
+            std::vector<uint8_t> scratch;
+            uint8_t *reference = new uint8_t[src->capacity];
+            memcpy(reference, reference_data(src, scratch), src->capacity);
+            copy->complete_bitmap = reference;
+        }
+        size_t bytes = sizeof(BitmapRef) + reference_bytes(copy);
+
+        std::vector<CompressedBitmap *> nodes;
+        for (CompressedBitmap *node = node_at(src->first_compressed_bitmap.load());
+             node != nullptr; node = node_at(node->next_bitmap.load())) {
+            if (node->is_ready()) nodes.push_back(node);
+        }
+        std::vector<uint8_t> buf;
+        if (src->delete_log.load() != nullptr || src->matrix.load() != nullptr ||
+            src->ptree_pool != nullptr) {
+            buf.resize(BITMAP_SIZE);
+        }
+        NodeOffset newest = NULL_NODE;
+        int newest_csn = copy->csn_range.first;
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+            DiffView src_diff = (*it)->load_diff();
+            DiffView diff = src_diff;
+            if (src_diff.encoding == ENC_LOG || src_diff.encoding == ENC_MATRIX ||
+                src_diff.encoding == ENC_PTREE) {
+                reconstruct(buf.data(), src, src_diff);
+                diff = compress_bitmap(buf.data(), src_diff.length, copy->complete_bitmap);
+            } else {
+                uint32_t diff_size = diff_bytes(src_diff);
+                diff.data = new uint16_t[diff_size / sizeof(uint16_t)];
+                memcpy(diff.data, src_diff.data, diff_size);
+            }
+            NodeOffset offset = arena->alloc();
+            CompressedBitmap *node = arena->at(offset);
+            node->bitmap_csn = (*it)->bitmap_csn;
+            node->next_bitmap.store(newest, std::memory_order_relaxed);
+            node->set_diff(diff);
+            newest = offset;
+            newest_csn = node->bitmap_csn;
+            copy->bitmap_cnt++;
+            bytes += sizeof(CompressedBitmap) + diff_bytes(diff);
+        }
+        copy->first_compressed_bitmap.store(newest);
+        copy->csn_range.second = std::min(copy->csn_range.second, newest_csn);
+        account_memory(bytes);
+        return copy;
+    }
+
+    /**
+     * Advance a running bitmap by one bulk input version.
+     */
+    static void apply_bulk_version(uint8_t *bitmap, const BulkVersion &version) {
+        if (version.bitmap != nullptr) {
+            memcpy(bitmap, version.bitmap, version.bitmap_len);
+        } else {
+            for (int k = 0; k < version.delta_cnt; k++) {
+                bitmap[version.delta[k] / 8] ^= (1 << (7 - version.delta[k] % 8));
+            }
+        }
+        memset(bitmap + version.bitmap_len, 0, BITMAP_SIZE - version.bitmap_len);
+    }
+
+    /**
+     * Build one unpublished group from versions [begin, end) and the
+     * materialized reference of its first version.  Runs on a bulk_load
+     * worker and touches no shared state besides the arena.
+     */
+    BitmapRef *build_bulk_group(const std::vector<BulkVersion> &versions,
+                                size_t begin, size_t end,
+                                uint8_t *reference, uint8_t *local) {
+        BitmapRef *ref = new BitmapRef();
+        ref->csn_range.first = versions[begin].csn;
+        ref->csn_range.second = versions[end - 1].csn;
+        ref->bitmap_cnt = (int)(end - begin);
+        ref->bitmap_len = versions[begin].bitmap_len;
+        ref->capacity = bitmap_capacity(ref->bitmap_len);
+        ref->log_tail_csn = versions[begin].csn;
+        memcpy(local, reference, ref->capacity);
+        set_reference(ref, reference);
+        size_t bytes = group_bytes(ref);
+
+        memset(local + ref->capacity, 0, BITMAP_SIZE - ref->capacity);
+        NodeOffset newest = NULL_NODE;
+        for (size_t i = begin; i < end; i++) {
+            DiffView diff;
+            if (i == begin) {
+                diff.data = new uint16_t[1];
+                diff.data[0] = 0;
+                diff.length = ref->bitmap_len;
+            } else {
+                apply_bulk_version(local, versions[i]);
+                diff = compress_bitmap(local, versions[i].bitmap_len, ref->complete_bitmap);
+            }
+            NodeOffset offset = arena->alloc();
+            CompressedBitmap *node = arena->at(offset);
+            node->bitmap_csn = versions[i].csn;
+            node->next_bitmap.store(newest, std::memory_order_relaxed);
+            node->set_diff(diff);
+            newest = offset;
+            bytes += sizeof(CompressedBitmap) + diff_bytes(diff);
+        }
+        ref->first_compressed_bitmap.store(newest);
+        account_memory(bytes);
+        return ref;
+    }
+
+    /**
+     * Ship a bulk-built group to the log sink as if it had been committed
+     * one version at a time; high_water is the newest loaded CSN.
+     */
+    void log_bulk_group(BitmapRef *ref, int high_water) {
+        std::vector<CompressedBitmap *> nodes;
+        for (CompressedBitmap *node = node_at(ref->first_compressed_bitmap.load());
+             node != nullptr; node = node_at(node->next_bitmap.load())) {
+            nodes.push_back(node);
+        }
+        DiffLogRecord record;
+        record.header.type = LOG_GROUP;
+        record.header.csn = ref->csn_range.first;
+        record.header.group_csn = ref->csn_range.first;
+        record.header.published_csn = ref->csn_range.first;
+        record.header.high_water_csn = std::max(high_water_csn.load(), high_water);
+        record.header.bitmap_len = ref->bitmap_len;
+        record.header.payload_bytes = ref->bitmap_len;
+        record.payload = ref->complete_bitmap;
+        emit_log(record);
+        for (auto it = nodes.rbegin() + 1; it < nodes.rend(); ++it) {
+            DiffView diff = (*it)->load_diff();
+            record.header.type = LOG_VERSION;
+            record.header.csn = (*it)->bitmap_csn;
+            record.header.published_csn = (*it)->bitmap_csn;
+            record.header.encoding = diff.encoding;
+            record.header.bitmap_len = diff.length;
+            record.header.payload_bytes = diff_bytes(diff);
+            record.payload = diff.data;
+            emit_log(record);
+        }
+    }
+
+    /**
+     * First group a read of require_csn has to look at: the read hint if
+     * the wanted version cannot be newer than it, the group list head
+     * otherwise.  Called inside an EpochGuard.  An unlinked group can sit
+     * in the hint until the reader that published it leaves; GC frees
+     * groups two epochs after unlinking them, so the check is safe.
+     */
+    BitmapRef *read_start(int require_csn) {
+        BitmapRef *hint = read_hint.load(std::memory_order_acquire);
+        if (hint != nullptr && !hint->unlinked.load() &&
+            require_csn <= hint->csn_range.second) {
+            return hint;
+        }
+        return first_ref.load();
+    }
+
+    /**
+     * Reader assist, bounded to work of the same order as the read just
+     * done and skipped whenever it would wait.
+     * A deep walk from the list head leaves a read hint; a walk that
+     * started at the hint only moves it deeper if it was much longer.
+     * A delete-log or matrix version whose decoding read more than a
+     * dense diff is marked hot, and re-encoded as a regular diff of the
+     * result on its next such read.
+     */
+    void assist_read(BitmapRef *ref, CompressedBitmap *node, const DiffView &diff,
+                     uint8_t *bitmap_result, int hops) {
+        if (!config.reader_assist) return;
+        BitmapRef *hint = read_hint.load(std::memory_order_relaxed);
+        int min_hops = hint != nullptr && ref->csn_range.first < hint->csn_range.first
+                           ? 4 * READ_HINT_MIN_HOPS : READ_HINT_MIN_HOPS;
+        if (hops >= min_hops && hint != ref && !ref->unlinked.load()) {
+            // Publish, then re-check: either we see GC's unlink, or GC's
+            // clearing CAS sees our hint.
+            read_hint.store(ref);
+            if (ref->unlinked.load()) {
+                BitmapRef *hinted = ref;
+                read_hint.compare_exchange_strong(hinted, nullptr);
+            }
+            read_hint_updates.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (diff.encoding != ENC_LOG && diff.encoding != ENC_MATRIX) return;
+        if (applied_diff_bytes(ref, diff) <= (size_t)diff.length) return;
+        if (!node->mark_hot()) return;
+        if (ref->share_cnt.load() > 1 || qos.overloaded()) return;
+        if (!ref->ref_lock.try_lock()) return;
+        if (node->load_diff().data == diff.data && !node->is_dead()) {
+            std::vector<uint8_t> scratch;
+            DiffView regular = compress_bitmap(bitmap_result, diff.length,
+                                               reference_data(ref, scratch));
+            node->set_diff(regular);
+            account_memory(diff_bytes(regular));
+            uint16_t *old_data = diff.data;
+            reclaimer.retire([old_data] { delete[] old_data; }, diff_bytes(diff));
+            reader_consolidations.fetch_add(1, std::memory_order_relaxed);
+        }
+        ref->ref_lock.unlock();
+    }
+
+    /**
+     * Union the diff of src into target (the CONSOLIDATE step).
+     * The replaced diff is retired, as readers may still be decoding it.
+     */
+    void union_into(CompressedBitmap *target, CompressedBitmap *src) {
+        DiffView target_diff = target->load_diff();
+        DiffView result = union_diff(target_diff, src->load_diff());
+        target->set_diff(result);
+        account_memory(diff_bytes(result));
+        uint16_t *old_data = target_diff.data;
+        reclaimer.retire([old_data] { delete[] old_data; }, diff_bytes(target_diff));
+    }
+
+    std::atomic<size_t> memory_bytes{0};                   // Live plus retired bytes
+    std::atomic<uint64_t> gc_runs{0};
+    std::atomic<uint64_t> gc_versions_freed{0};
+    std::atomic<uint64_t> gc_groups_freed{0};
+    std::atomic<uint64_t> log_versions{0};
+    std::atomic<uint64_t> log_fallbacks{0};
+    std::atomic<uint64_t> matrix_versions{0};
+    std::atomic<uint64_t> ptree_versions{0};
+    std::atomic<uint64_t> ptree_positions{0};
+    std::atomic<uint64_t> ptree_nodes{0};
+    std::atomic<uint64_t> read_hint_updates{0};
+    std::atomic<uint64_t> reader_consolidations{0};
+    std::atomic<int64_t> pending_versions{0};              // Placeholders not yet published
+    std::atomic<uint64_t> admission_delayed{0};
+    std::atomic<uint64_t> delta_reference_groups{0};
+    std::atomic<uint64_t> reference_cache_fills{0};
+    std::atomic<uint64_t> reference_cache_drops{0};
+    std::atomic<uint64_t> reference_reanchors{0};
+    std::atomic<uint64_t> admission_delay_us{0};
+    std::mutex gc_lock;                                    // One GC pass at a time
+
+    void account_memory(size_t bytes) {
+        memory_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    /**
+     * Bytes held against the memory budget: memory_bytes plus, when
+     * interning, the reference pool pages that groups do not account.
+     */
+    size_t charged_bytes() const {
+        size_t bytes = memory_bytes.load();
+        if (config.intern_references) bytes += ReferencePool::instance().get_page_bytes();
+        return bytes;
+    }
+
+    /**
+     * Install a new group's reference from a buffer of ref->capacity
+     * bytes, taking ownership of it.  With intern_references the buffer
+     * is replaced by the shared pool page of the same content.
+     */
+    void set_reference(BitmapRef *ref, uint8_t *reference) {
+        ref->fill = ReferencePool::classify(reference, ref->bitmap_len);
+        if (config.intern_references) {
+            ref->complete_bitmap = ReferencePool::instance().intern(reference, ref->capacity);
+            ref->interned = true;
+            delete[] reference;
+        } else {
+            ref->complete_bitmap = reference;
+        }
+    }
+
+    static void release_reference(const BitmapRef *ref) {
+        if (ref->interned) {
+            ReferencePool::instance().release(ref->complete_bitmap);
+        } else {
+            delete[] ref->complete_bitmap;
+        }
+        delete ref->reference_delta.load();
+        delete[] ref->cached_reference.load();
+    }
+
+    /**
+     * Reference bytes a group accounts for; shared pool pages are
+     * accounted by the pool.
+     */
+    static size_t reference_bytes(const BitmapRef *ref) {
+        if (ref->interned) return 0;
+        size_t bytes = ref->complete_bitmap != nullptr ? ref->capacity : 0;
+        const ReferenceDelta *delta = ref->reference_delta.load();
+        if (delta != nullptr) bytes += sizeof(ReferenceDelta) + diff_bytes(delta->diff);
+        if (ref->cached_reference.load() != nullptr) bytes += ref->capacity;
+        return bytes;
+    }
+
+    /**
+     * With delta_references, store a new group's reference, a buffer of
+     * ref->capacity bytes, as a diff against the head group's reference
+     * and keep the buffer as its cached copy for commits.  Returns false,
+     * leaving the buffer to the caller, when the group should be an
+     * anchor instead.  The head cannot be freed meanwhile, as GC skips
+     * the two newest groups.
+     */
+    bool encode_reference_delta(BitmapRef *ref, uint8_t *reference) {
+        BitmapRef *base = first_ref.load();
+        if (!config.delta_references || base == nullptr || base->capacity != ref->capacity ||
+            base->anchor_distance + 1 >= config.reference_anchor_interval ||
+            ReferencePool::classify(reference, ref->bitmap_len) != FILL_NONE) {
+            return false;
+        }
+        std::vector<uint8_t> scratch;
+        DiffView delta = compress_bitmap(reference, ref->capacity, reference_data(base, scratch));
+        if (2 * diff_bytes(delta) > (size_t)ref->capacity) {
+            delete[] delta.data;
+            return false;
+        }
+        ref->reference_delta.store(new ReferenceDelta{base, delta});
+        ref->anchor_distance = base->anchor_distance + 1;
+        ref->cached_reference.store(reference);
+        delta_reference_groups.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * Keep a delta group's materialized reference while it is hot, i.e.
+     * read at least reference_cache_reads times since the last refresh:
+     * fill it when a hot group lacks one, drop it when the group cooled.
+     * Called under ref_lock; groups with commits in flight or shared
+     * with a fork keep theirs.
+     */
+    void refresh_reference_cache(BitmapRef *ref) {
+        if (ref->reference_delta.load() == nullptr || ref->unlinked.load() ||
+            ref->pending_cnt > 0 || ref->share_cnt.load() > 1) {
+            return;
+        }
+        bool hot = ref->reference_reads.exchange(0) >= config.reference_cache_reads;
+        const uint8_t *cached = ref->cached_reference.load();
+        if (cached == nullptr && hot) {
+            uint8_t *full = new uint8_t[ref->capacity];
+            materialize_reference(ref, full);
+            ref->cached_reference.store(full, std::memory_order_release);
+            account_memory(ref->capacity);
+            reference_cache_fills.fetch_add(1, std::memory_order_relaxed);
+        } else if (cached != nullptr && !hot) {
+            ref->cached_reference.store(nullptr);
+            reclaimer.retire([cached] { delete[] cached; }, ref->capacity);
+            reference_cache_drops.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Detach a delta group from a base GC is about to free: re-encode it
+     * against the nearest older group that survives, or keep its cached
+     * copy for good if there is none or the diff would not pay off.
+     * Called under ref_lock, with freed listing the groups being freed.
+     */
+    void reanchor_reference(BitmapRef *ref, const std::vector<BitmapRef *> &freed) {
+        ReferenceDelta *old_delta = ref->reference_delta.load();
+        std::vector<uint8_t> full(ref->capacity);
+        materialize_reference(ref, full.data());
+
+        BitmapRef *base = old_delta->base;
+        while (base != nullptr && std::find(freed.begin(), freed.end(), base) != freed.end()) {
+            const ReferenceDelta *base_delta = base->reference_delta.load();
+            base = base_delta != nullptr ? base_delta->base : nullptr;
+        }
+        ReferenceDelta *new_delta = nullptr;
+        if (base != nullptr) {
+            std::vector<uint8_t> scratch;
+            DiffView diff = compress_bitmap(full.data(), ref->capacity, reference_data(base, scratch));
+            if (2 * diff_bytes(diff) <= (size_t)ref->capacity) {
+                new_delta = new ReferenceDelta{base, diff};
+                account_memory(sizeof(ReferenceDelta) + diff_bytes(diff));
+            } else {
+                delete[] diff.data;
+            }
+        }
+        if (new_delta == nullptr && ref->cached_reference.load() == nullptr) {
+            uint8_t *cached = new uint8_t[ref->capacity];
+            memcpy(cached, full.data(), ref->capacity);
+            ref->cached_reference.store(cached, std::memory_order_release);
+            account_memory(ref->capacity);
+        }
+        ref->reference_delta.store(new_delta, std::memory_order_release);
+        ref->anchor_distance = new_delta != nullptr ? base->anchor_distance + 1 : 0;
+        reclaimer.retire([old_delta] { delete old_delta; },
+                         sizeof(ReferenceDelta) + diff_bytes(old_delta->diff));
+        reference_reanchors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Bytes held by a group itself: reference bitmap and delete log.
+     */
+    static size_t group_bytes(const BitmapRef *ref) {
+        const MatrixBlock *block = ref->matrix.load();
+        return sizeof(BitmapRef) + reference_bytes(ref) + ref->log_capacity * sizeof(uint16_t) +
+               (block ? block->bytes() : 0) + (ref->ptree_pool ? ref->ptree_pool->bytes() : 0);
+    }
+
+    /**
+     * A version considered by a GC pass.
+     */
+    struct GcVersion {
+        BitmapRef *ref = nullptr;
+        CompressedBitmap *node = nullptr;
+        int64_t ts_us = 0;
+        bool has_time = false;                             // Publication time known
+        bool pinned = false;                               // Visible to an active snapshot
+        bool keep = true;
+        size_t bytes = 0;
+    };
+
+    /**
+     * Mark which versions survive under the given granularity.
+     * versions is ordered newest first.  Returns the bytes that would
+     * be freed, counting groups that lose every version.
+     */
+    size_t plan_retention(std::vector<GcVersion> &versions,
+                          int64_t horizon_us, int64_t granularity) {
+        size_t freed = 0;
+        int64_t last_bucket = INT64_MIN;
+        bool group_kept = false;
+        for (size_t i = 0; i < versions.size(); i++) {
+            GcVersion &v = versions[i];
+            if (i == 0 || versions[i - 1].ref != v.ref) group_kept = false;
+            v.keep = v.pinned || !v.has_time || v.ts_us >= horizon_us;
+            if (!v.keep && granularity > 0 && v.ts_us / granularity != last_bucket) {
+                v.keep = true;
+            }
+            if (v.keep && v.has_time && v.ts_us < horizon_us && granularity > 0) {
+                last_bucket = v.ts_us / granularity;
+            }
+            if (!v.keep) freed += v.bytes;
+            group_kept |= v.keep;
+            bool group_end = i + 1 == versions.size() || versions[i + 1].ref != v.ref;
+            if (group_end && !group_kept) {
+                freed += group_bytes(v.ref);
+            }
+        }
+        return freed;
+    }
+
+    /**
+     * Unlink the versions plan_retention dropped and retire them.
+     * Groups left without versions are unlinked as a whole, after the
+     * groups whose delta references depend on them are re-anchored.
+     */
+    void apply_retention(std::vector<GcVersion> &versions) {
+        std::vector<BitmapRef *> empty_refs;
+        size_t i = 0;
+        while (i < versions.size()) {
+            qos.background_yield();
+            BitmapRef *ref = versions[i].ref;
+            size_t end = i;
+            bool any_dropped = false;
+            while (end < versions.size() && versions[end].ref == ref) {
+                any_dropped |= !versions[end].keep;
+                end++;
+            }
+            if (any_dropped) {
+                std::lock_guard<SiteLock<std::mutex>> lk(ref->ref_lock);
+                std::atomic<NodeOffset> *link = &ref->first_compressed_bitmap;
+                size_t k = i;
+                while (link->load() != NULL_NODE) {
+                    NodeOffset offset = link->load();
+                    CompressedBitmap *node = node_at(offset);
+                    while (k < end && versions[k].node != node) k++;
+                    if (k < end && !versions[k].keep) {
+                        link->store(node->next_bitmap.load());
+                        retire_node(offset);
+                        ref->bitmap_cnt--;
+                        gc_versions_freed.fetch_add(1);
+                    } else {
+                        link = &node->next_bitmap;
+                    }
+                }
+                if (ref->first_compressed_bitmap.load() == NULL_NODE) {
+                    empty_refs.push_back(ref);
+                }
+            }
+            i = end;
+        }
+
+        if (empty_refs.empty()) return;
+        std::lock_guard<SiteLock<std::mutex>> lk(head_lock);
+        for (BitmapRef *ref = first_ref.load(); ref != nullptr; ref = ref->next_ref.load()) {
+            const ReferenceDelta *delta = ref->reference_delta.load();
+            if (delta != nullptr &&
+                std::find(empty_refs.begin(), empty_refs.end(), delta->base) != empty_refs.end() &&
+                std::find(empty_refs.begin(), empty_refs.end(), ref) == empty_refs.end()) {
+                std::lock_guard<SiteLock<std::mutex>> ref_lk(ref->ref_lock);
+                reanchor_reference(ref, empty_refs);
+            }
+        }
+        for (BitmapRef *ref : empty_refs) {
+            std::atomic<BitmapRef*> *link = &first_ref;
+            while (link->load() != nullptr && link->load() != ref) {
+                link = &link->load()->next_ref;
+            }
+            if (link->load() == nullptr) continue;
+            link->store(ref->next_ref.load());
+            size_t bytes;
+            {
+                std::lock_guard<SiteLock<std::mutex>> ref_lk(ref->ref_lock);
+                ref->unlinked.store(true);
+                bytes = group_bytes(ref);
+            }
+            BitmapRef *hinted = ref;
+            read_hint.compare_exchange_strong(hinted, nullptr);
+            reclaimer.retire([ref] {
+                release_reference(ref);
+                delete ref;
+            }, bytes, 2);
+            gc_groups_freed.fetch_add(1);
+        }
+    }
+
+    /**
+     * Retire an unlinked version node and its diff.
+     */
+    void retire_node(NodeOffset offset) {
+        CompressedBitmap *node = node_at(offset);
+        DiffView diff = node->load_diff();
+        uint16_t *data = diff.data;
+        node->mark_dead();
+        reclaimer.retire([this, offset, data] {
+            delete[] data;
+            arena->free(offset);
+        }, sizeof(CompressedBitmap) + diff_bytes(diff));
+    }
+
+    /**
+     * Background GC driven by config.gc_interval_ms and the active
+     * snapshot list.
+     */
+    void gc_loop() {
+        auto next_run = std::chrono::steady_clock::now();
+        while (!stop_flag.load()) {
+            next_run += std::chrono::milliseconds(config.gc_interval_ms);
+            while (!stop_flag.load() && std::chrono::steady_clock::now() < next_run) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(
+                    std::min(config.gc_interval_ms, 10)));
+            }
+            if (stop_flag.load()) break;
+            collect_garbage(wall_clock_us(), tsn_list);
+        }
+    }
+
+    /**
+     * A commit handed to the pipeline.
+     */
+    struct CommitJob {
+        BitmapRef *ref = nullptr;
+        CompressedBitmap *bitmap = nullptr;
+        uint8_t *staged_bitmap = nullptr;                  // DIFF input, owned by the job
+        int bitmap_len = BITMAP_SIZE;
+        DiffView diff;                                     // DIFF output
+        uint64_t submit_ns = 0;                            // For the commit latency seen by QoS
+    };
+
+    BoundedMpmcQueue<CommitJob> *diff_queue = nullptr;     // Committers -> DIFF/LINK
+    BoundedMpmcQueue<CommitJob> *publish_queue = nullptr;  // LINK -> CONSOLIDATE/PUBLISH
+    std::vector<std::thread> pipeline_threads;
+    std::atomic<bool> pipeline_running{false};
+    std::atomic<uint64_t> pipeline_submitted{0};
+    std::atomic<uint64_t> pipeline_completed{0};
+
+    std::atomic<uint64_t> stage_count[STAGE_NUM] = {};
+    std::atomic<uint64_t> stage_ns[STAGE_NUM] = {};
+
+    DiffLogSink log_sink;                                  // Replication hook, may be empty
+    std::atomic<int> high_water_csn{-1};                   // Highest published CSN
+
+    /**
+     * Stamp a record with the visible watermark and hand it to the sink.
+     * Records are emitted before their CSN is published, so every CSN up
+     * to the stamp has been emitted before the record carrying it.
+     */
+    void emit_log(DiffLogRecord &record) {
+        record.header.visible_csn = visible_csn.load();
+        log_sink(record);
+    }
+
+    void raise_high_water(int csn) {
+        int cur = high_water_csn.load();
+        while (cur < csn && !high_water_csn.compare_exchange_weak(cur, csn)) {}
+        note_published(csn);
+    }
+
+    // Visibility watermark for wait_for_csn.  Reservations arrive in CSN
+    // order (insert_null is serialized by the caller) and are published
+    // in any order; the watermark is the last CSN of the published prefix.
+    // in_flight holds one published flag per CSN from in_flight_base on;
+    // CSNs skipped between reservations count as published.
+    std::mutex visible_lock;
+    std::deque<bool> in_flight;                            // Published flags, oldest first
+    int in_flight_base = 0;                                // CSN of in_flight.front()
+    std::atomic<int> visible_csn{-1};                      // Futex word, see wait_for_csn
+    std::atomic<int> csn_waiters{0};
+    std::atomic<uint64_t> csn_waits{0};                    // wait_for_csn calls that had to block
+    std::atomic<uint64_t> csn_wakes{0};                    // Futex wakes issued by publishers
+
+    static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int word");
 
-    CompressedBitmap()
-        : bitmap_csn(0), next_bitmap(nullptr),
-          compressed_bitmap(nullptr), is_compressed(false) {}
-};
+    // Time samples of the watermark.  The tail pair is updated on every
+    // advance without locking, time first; a reader that loads the CSN
+    // first gets a time by which that CSN was visible.  The index itself
+    // takes one sample per granularity bucket.
+    std::atomic<int64_t> visible_tail_us{0};
+    std::atomic<int> visible_tail_csn{-1};
+    std::atomic<int64_t> next_time_sample_us{0};
 
-/**
- * Reference bitmap (group head).
- * Maintains a complete bitmap and a chain of differential versions.
- */
-struct BitmapRef {
-    std::mutex ref_lock;                                  // Synchronization for group updates
-    int bitmap_cnt;                                       // Number of versions in this group
-    std::pair<int, int> csn_range;                         // CSN range covered by this group
-    std::atomic<BitmapRef*> next_ref;                      // Next group
-    std::atomic<CompressedBitmap*> first_compressed_bitmap;
-    uint8_t *complete_bitmap;                              // Reference bitmap
+    /**
+     * Record that the watermark reached csn; called after it is stored.
+     */
+    void sample_visible(int csn) {
+        int64_t now = wall_clock_us();
+        int64_t ts = visible_tail_us.load(std::memory_order_relaxed);
+        while (ts < now && !visible_tail_us.compare_exchange_weak(ts, now)) {}
+        int tail = visible_tail_csn.load(std::memory_order_relaxed);
+        while (tail < csn && !visible_tail_csn.compare_exchange_weak(tail, csn)) {}
 
-    BitmapRef()
-        : bitmap_cnt(0), csn_range(0, 0),
-          next_ref(nullptr), first_compressed_bitmap(nullptr),
-          complete_bitmap(nullptr) {}
-};
+        int64_t next = next_time_sample_us.load(std::memory_order_relaxed);
+        int64_t granularity = std::max<int64_t>(1, config.time_index_granularity_us);
+        if (now >= next &&
+            next_time_sample_us.compare_exchange_strong(next, now - now % granularity + granularity)) {
+            time_index.record(now, csn);
+        }
+    }
 
-/**
- * BitmapController manages multi-version bitmap chains with
- * hierarchical grouped differential encoding.
- */
-class BitmapController {
-  public:
-    BitmapController(std::vector<int>& tsn_list_ref)
-        : tsn_list(tsn_list_ref), stop_flag(false)
-    {
-        head_bitmap_cnt = 9;
+    void note_reserved(int csn) {
+        std::lock_guard<std::mutex> lk(visible_lock);
+        if (in_flight.empty()) {
+            in_flight_base = csn;
+        } else if (csn < in_flight_base + (int)in_flight.size()) {
+            return;
+        }
+        in_flight.resize(csn - in_flight_base, true);
+        in_flight.push_back(false);
     }
 
-    ~BitmapController() {}
+    /**
+     * Mark csn published and advance the watermark over the published
+     * prefix.  A CSN published without a reservation (a new group, bulk
+     * load or replay) is visible at once unless older reservations are
+     * still in flight.
+     */
+    void note_published(int csn) {
+        int advanced_to = -1;
+        {
+            std::lock_guard<std::mutex> lk(visible_lock);
+            if (in_flight.empty()) {
+                if (csn > visible_csn.load()) advanced_to = csn;
+            } else if (csn >= in_flight_base) {
+                size_t offset = csn - in_flight_base;
+                if (offset >= in_flight.size()) in_flight.resize(offset + 1, true);
+                in_flight[offset] = true;
+            }
+            while (!in_flight.empty() && in_flight.front()) {
+                advanced_to = std::max(advanced_to, in_flight_base);
+                in_flight.pop_front();
+                in_flight_base++;
+            }
+            if (advanced_to > visible_csn.load()) {
+                visible_csn.store(advanced_to);
+            } else {
+                advanced_to = -1;
+            }
+        }
+        if (advanced_to >= 0) sample_visible(advanced_to);
+        if (advanced_to >= 0 && csn_waiters.load() > 0) {
+            syscall(SYS_futex, reinterpret_cast<int *>(&visible_csn), FUTEX_WAKE_PRIVATE,
+                    INT_MAX, nullptr, nullptr, 0);
+            csn_wakes.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
 
     /**
-     * Bitwise XOR for bitmap difference computation.
+     * Size in bytes of an encoded diff.
      */
-    static void xor_function(uint8_t *a, uint8_t *b, uint8_t *result) {
-        for (size_t i = 0; i < BITMAP_SIZE; ++i) {
-            result[i] = a[i] ^ b[i];
+    static uint32_t diff_bytes(const DiffView &diff) {
+        switch (diff.encoding) {
+        case ENC_LOG:
+            return 2 * sizeof(uint16_t);
+        case ENC_MATRIX:
+            return sizeof(uint16_t);
+        case ENC_PTREE:
+            return sizeof(const PtreeNode *);
+        case ENC_DENSE:
+            return (diff.length + 1) / 2 * sizeof(uint16_t);
+        case ENC_RUNS:
+            return (2 * diff.data[0] + 1) * sizeof(uint16_t);
+        default:
+            return (diff.data[0] + 1) * sizeof(uint16_t);
         }
     }
 
     /**
-     * Union two sorted sparse bitmap arrays.
+     * Bytes a reconstruction reads besides the reference: the diff
+     * itself, the delete-log prefix, or the whole change matrix.
      */
-    static void union_sorted_array(uint16_t*& a, uint16_t* b) {
-        int a_size = a[0];
-        int b_size = b[0];
+    static size_t applied_diff_bytes(BitmapRef *ref, const DiffView &diff) {
+        switch (diff.encoding) {
+        case ENC_LOG:
+            return log_prefix(diff) * sizeof(uint16_t);
+        case ENC_MATRIX: {
+            const MatrixBlock *block = ref->matrix.load(std::memory_order_acquire);
+            if (block == nullptr) return 0;
+            return block->len.load(std::memory_order_acquire) *
+                   (sizeof(uint16_t) + sizeof(uint64_t));
+        }
+        case ENC_PTREE: {
+            const PtreeNode *root = ptree_root(diff);
+            return root == nullptr ? 0 : root->size * sizeof(uint16_t);
+        }
+        case ENC_SPARSE:
+            return diff.data[0] == 0 ? 0 : diff_bytes(diff);
+        default:
+            return diff_bytes(diff);
+        }
+    }
 
-        uint16_t* a_data = a + 1;
-        uint16_t* b_data = b + 1;
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
 
-        uint16_t* temp = new uint16_t[a_size + b_size + 1];
-        int i = 0, j = 0, k = 1;
+    void record_stage(CommitStage stage, uint64_t start_ns) {
+        stage_count[stage].fetch_add(1, std::memory_order_relaxed);
+        stage_ns[stage].fetch_add(now_ns() - start_ns, std::memory_order_relaxed);
+    }
 
-        while (i < a_size && j < b_size) {
-            if (a_data[i] < b_data[j]) {
-                temp[k++] = a_data[i++];
-            } else if (a_data[i] > b_data[j]) {
-                temp[k++] = b_data[j++];
+    /**
+     * DIFF: encode a bitmap against the group reference.
+     */
+    DiffView stage_diff(BitmapRef *ref, uint8_t *original_bitmap, int bitmap_len) {
+        uint64_t ts = now_ns();
+        assert(bitmap_len <= ref->capacity);
+        std::vector<uint8_t> scratch;
+        DiffView diff = compress_bitmap(original_bitmap, bitmap_len,
+                                        reference_data(ref, scratch));
+        record_stage(STAGE_DIFF, ts);
+        return diff;
+    }
+
+    /**
+     * LINK: attach an encoded diff to its placeholder.
+     */
+    void stage_link(CompressedBitmap *bitmap, const DiffView &diff) {
+        uint64_t ts = now_ns();
+        bitmap->set_diff(diff);
+        account_memory(diff_bytes(diff));
+        record_stage(STAGE_LINK, ts);
+    }
+
+    /**
+     * CONSOLIDATE and PUBLISH: propagate the diff into newer filled versions
+     * and extend the group's visible CSN range, both under ref_lock.
+     */
+    void stage_consolidate_and_publish(BitmapRef *ref, CompressedBitmap *bitmap) {
+        uint64_t ts = now_ns();
+        ref->ref_lock.lock();
+        ref->bitmap_cnt++;
+
+        CompressedBitmap *temp_bmp = node_at(ref->first_compressed_bitmap.load());
+        CompressedBitmap *start_compress_point = nullptr;
+        int temp_csn = -1;
+
+        while (temp_bmp != nullptr && temp_bmp != bitmap) {
+            if (!temp_bmp->is_ready()) {
+                temp_csn = -1;
+                start_compress_point = nullptr;
             } else {
-                temp[k++] = a_data[i];
-                i++; j++;
+                temp_csn = temp_bmp->bitmap_csn;
+                start_compress_point = temp_bmp;
             }
+            temp_bmp = node_at(temp_bmp->next_bitmap.load());
         }
-        while (i < a_size) temp[k++] = a_data[i++];
-        while (j < b_size) temp[k++] = b_data[j++];
 
-        temp[0] = k - 1;
+        if (config.monotone_deletes || config.matrix_groups) {
+            // Set-only versions already contain every older delete, and
+            // matrix columns are exact per version.
+            start_compress_point = nullptr;
+        }
+        if (start_compress_point != nullptr) {
+            temp_bmp = start_compress_point;
+            while (temp_bmp != nullptr && temp_bmp != bitmap) {
+                union_into(temp_bmp, bitmap);
+                temp_bmp = node_at(temp_bmp->next_bitmap.load());
+            }
+        }
+        record_stage(STAGE_CONSOLIDATE, ts);
 
-        delete[] a;
-        a = new uint16_t[k];
-        for (int t = 0; t < k; t++) {
-            a[t] = temp[t];
+        ts = now_ns();
+        if (temp_csn == -1) {
+            temp_csn = bitmap->bitmap_csn;
         }
-        delete[] temp;
+        ref->csn_range.second =
+            std::max(ref->csn_range.second, temp_csn);
+        ref->pending_cnt--;
+        pending_versions.fetch_sub(1, std::memory_order_relaxed);
+
+        if (log_sink) {
+            DiffLogRecord record;
+            record.header.type = LOG_VERSION;
+            record.header.csn = bitmap->bitmap_csn;
+            record.header.group_csn = ref->csn_range.first;
+            record.header.union_from_csn =
+                start_compress_point ? start_compress_point->bitmap_csn : -1;
+            record.header.published_csn = ref->csn_range.second;
+            record.header.high_water_csn = std::max(high_water_csn.load(), bitmap->bitmap_csn);
+            DiffView diff = bitmap->load_diff();
+            record.header.encoding = diff.encoding;
+            record.header.bitmap_len = diff.length;
+            record.header.payload_bytes = diff_bytes(diff);
+            record.payload = diff.data;
+            emit_log(record);
+        }
+        raise_high_water(bitmap->bitmap_csn);
+        if (config.matrix_groups) {
+            append_matrix_column(ref, bitmap);
+        } else if (config.monotone_deletes && !ref->log_frozen) {
+            advance_delete_log(ref);
+        } else if (config.position_trees) {
+            advance_position_tree(ref);
+        }
+
+        ref->ref_lock.unlock();
+        record_stage(STAGE_PUBLISH, ts);
     }
 
     /**
-     * Compress a bitmap version using differential encoding.
-     * Dense differences fall back to full bitmap storage.
+     * Matrix mode: move a published version's diff into a new column of
+     * the group's change matrix.  Only sets mask bits and appends rows.
+     * Called under ref_lock.
      */
-    uint16_t *compress_bitmap(uint8_t *original_bitmap,
-                              uint8_t *complete_bitmap,
-                              bool &is_compressed) {
-        uint8_t *temp = new uint8_t[BITMAP_SIZE];
-        xor_function(original_bitmap, complete_bitmap, temp);
+    void append_matrix_column(BitmapRef *ref, CompressedBitmap *bitmap) {
+        DiffView diff = bitmap->load_diff();
+        if (ref->matrix_slots >= MAX_MATRIX_VERSIONS) return;
+        int slot = ref->matrix_slots++;
+        uint64_t bit = 1ull << slot;
 
-        int total_cnt = 0;
-        for (int i = 0; i < BITMAP_SIZE; i++) {
-            if (temp[i] != 0) {
-                for (int j = 0; j < 8; j++) {
-                    if (temp[i] & (1 << (7 - j))) {
-                        total_cnt++;
-                    }
-                }
+        std::vector<uint16_t> positions;
+        for_each_diff_position(diff, [&](int pos) { positions.push_back(pos); });
+        MatrixBlock *block = ref->matrix.load();
+        uint32_t len = block ? block->len.load() : 0;
+        uint32_t new_rows = 0;
+        for (uint16_t pos : positions) {
+            if (ref->matrix_index.find(pos) == ref->matrix_index.end()) new_rows++;
+        }
+        if (block == nullptr || len + new_rows > block->capacity) {
+            uint32_t capacity = block ? block->capacity : 64;
+            while (capacity < len + new_rows) capacity *= 2;
+            MatrixBlock *grown = new MatrixBlock(capacity);
+            for (uint32_t i = 0; i < len; i++) {
+                grown->rows[i] = block->rows[i];
+                grown->masks[i].store(block->masks[i].load(std::memory_order_relaxed),
+                                      std::memory_order_relaxed);
+            }
+            grown->len.store(len, std::memory_order_relaxed);
+            ref->matrix.store(grown, std::memory_order_release);
+            account_memory(grown->bytes());
+            if (block != nullptr) {
+                reclaimer.retire([block] { delete block; }, block->bytes());
             }
+            block = grown;
         }
 
-        if (total_cnt >= BITMAP_SIZE / 16) {
-            is_compressed = false;
-            uint16_t *compressed_bitmap = new uint16_t[BITMAP_SIZE / 2];
-            for (int i = 0; i < BITMAP_SIZE / 2; i++) {
-                compressed_bitmap[i] =
-                    static_cast<uint16_t>(original_bitmap[2 * i]) |
-                    (static_cast<uint16_t>(original_bitmap[2 * i + 1]) << 8);
+        for (uint16_t pos : positions) {
+            auto it = ref->matrix_index.find(pos);
+            if (it != ref->matrix_index.end()) {
+                block->masks[it->second].fetch_or(bit, std::memory_order_relaxed);
+            } else {
+                block->rows[len] = pos;
+                block->masks[len].store(bit, std::memory_order_relaxed);
+                ref->matrix_index.emplace(pos, len);
+                len++;
             }
-            return compressed_bitmap;
         }
+        block->len.store(len, std::memory_order_release);
 
-        is_compressed = true;
-        uint16_t *compressed_bitmap = new uint16_t[total_cnt + 1];
-        compressed_bitmap[0] = total_cnt;
+        DiffView column;
+        column.data = new uint16_t[1];
+        column.data[0] = slot;
+        column.encoding = ENC_MATRIX;
+        column.length = diff.length;
+        bitmap->set_diff(column);
+        account_memory(diff_bytes(column));
+        uint16_t *old_data = diff.data;
+        reclaimer.retire([old_data] { delete[] old_data; }, diff_bytes(diff));
+        matrix_versions.fetch_add(1);
+    }
 
-        int pos = 1;
-        for (int i = 0; i < BITMAP_SIZE; i++) {
-            if (temp[i] != 0) {
-                for (int j = 0; j < 8; j++) {
-                    if (temp[i] & (1 << (7 - j))) {
-                        compressed_bitmap[pos++] = i * 8 + j;
-                    }
+    /**
+     * Call fn for every bit position flipped by a diff.
+     */
+    template <class Fn>
+    static void for_each_diff_position(const DiffView &diff, Fn fn) {
+        const uint16_t *d = diff.data;
+        if (diff.encoding == ENC_SPARSE) {
+            for (int i = 1; i <= d[0]; i++) fn(d[i]);
+        } else if (diff.encoding == ENC_RUNS) {
+            for (int r = 0; r < d[0]; r++) {
+                for (int pos = d[1 + 2 * r]; pos < d[1 + 2 * r] + d[2 + 2 * r]; pos++) fn(pos);
+            }
+        } else {
+            for (int i = 0; i < diff.length; i++) {
+                uint8_t byte = (i % 2) ? (d[i / 2] >> 8) : (d[i / 2] & 0xFF);
+                for (int j = 0; byte != 0 && j < 8; j++) {
+                    if (byte & (1 << (7 - j))) fn(i * 8 + j);
                 }
             }
         }
-        return compressed_bitmap;
     }
 
     /**
-     * Reconstruct a visible bitmap version from reference and differential bitmap.
+     * Monotone mode: re-encode the published versions directly after the
+     * log tail as delete-log prefixes, oldest first, stopping at the first
+     * placeholder.  A version that does not contain its predecessor
+     * freezes the log and keeps its regular diff.  Called under ref_lock.
      */
-    void decompress_bitmap(uint8_t *bitmap_result,
-                           uint8_t *complete_bitmap,
-                           uint16_t *compressed_bitmap,
-                           bool is_compressed) {
-        memcpy(bitmap_result, complete_bitmap, BITMAP_SIZE);
+    void advance_delete_log(BitmapRef *ref) {
+        std::vector<CompressedBitmap *> newer;
+        for (CompressedBitmap *node = node_at(ref->first_compressed_bitmap.load());
+             node != nullptr && node->bitmap_csn > ref->log_tail_csn;
+             node = node_at(node->next_bitmap.load())) {
+            newer.push_back(node);
+        }
 
-        if (!is_compressed) {
-            for (int i = 0; i < BITMAP_SIZE / 2; i++) {
-                bitmap_result[2 * i] ^= compressed_bitmap[i] & 0xFF;
-                bitmap_result[2 * i + 1] ^= (compressed_bitmap[i] >> 8) & 0xFF;
+        std::vector<uint8_t> logged;
+        std::vector<uint16_t> added;
+        std::vector<uint8_t> scratch;
+        const uint8_t *reference = nullptr;
+        for (auto it = newer.rbegin(); it != newer.rend(); ++it) {
+            CompressedBitmap *node = *it;
+            if (!node->is_ready()) return;
+            if (logged.empty()) {
+                reference = reference_data(ref, scratch);
+                logged.assign(ref->capacity, 0);
+                const uint16_t *log = ref->delete_log.load();
+                for (int i = 0; i < ref->log_len; i++) {
+                    logged[log[i] / 8] |= (1 << (7 - log[i] % 8));
+                }
             }
-        } else {
-            int total_cnt = compressed_bitmap[0];
-            for (int i = 1; i <= total_cnt; i++) {
-                int pos = compressed_bitmap[i];
-                int byte_index = pos / 8;
-                int bit_index = pos % 8;
-                bitmap_result[byte_index] ^= (1 << (7 - bit_index));
+
+            DiffView diff = node->load_diff();
+            bool monotone = true;
+            int kept = 0;
+            added.clear();
+            for_each_diff_position(diff, [&](int pos) {
+                uint8_t mask = 1 << (7 - pos % 8);
+                if (reference[pos / 8] & mask) {
+                    monotone = false;
+                } else if (logged[pos / 8] & mask) {
+                    kept++;
+                } else {
+                    added.push_back(pos);
+                }
+            });
+            if (!monotone || kept != ref->log_len) {
+                ref->log_frozen = true;
+                log_fallbacks.fetch_add(1);
+                return;
             }
+
+            append_delete_log(ref, added);
+            for (uint16_t pos : added) logged[pos / 8] |= (1 << (7 - pos % 8));
+
+            DiffView log_diff;
+            log_diff.data = new uint16_t[2];
+            log_diff.data[0] = ref->log_len & 0xFFFF;
+            log_diff.data[1] = ref->log_len >> 16;
+            log_diff.encoding = ENC_LOG;
+            log_diff.length = diff.length;
+            node->set_diff(log_diff);
+            account_memory(diff_bytes(log_diff));
+            uint16_t *old_data = diff.data;
+            reclaimer.retire([old_data] { delete[] old_data; }, diff_bytes(diff));
+            ref->log_tail_csn = node->bitmap_csn;
+            log_versions.fetch_add(1);
         }
     }
 
     /**
-     * Locate and reconstruct a bitmap version visible to a given CSN.
+     * Append positions to a group's delete log, growing it geometrically.
+     * Readers only index entries below their version's prefix, so the
+     * array is replaced rather than reallocated in place.
      */
-    bool get_bitmap(int require_csn, uint8_t *bitmap_result) {
-        BitmapRef *temp_refp = first_ref.load();
-
-        while (temp_refp != nullptr) {
-            if (require_csn < temp_refp->csn_range.first) {
-                temp_refp = temp_refp->next_ref.load();
-            } else if (require_csn > temp_refp->csn_range.second) {
-                return false;
-            } else {
-                break;
+    void append_delete_log(BitmapRef *ref, const std::vector<uint16_t> &positions) {
+        int needed = ref->log_len + (int)positions.size();
+        uint16_t *log = ref->delete_log.load();
+        if (needed > ref->log_capacity) {
+            int capacity = std::max(64, ref->log_capacity);
+            while (capacity < needed) capacity *= 2;
+            uint16_t *grown = new uint16_t[capacity];
+            if (ref->log_len > 0) memcpy(grown, log, ref->log_len * sizeof(uint16_t));
+            ref->delete_log.store(grown, std::memory_order_release);
+            account_memory(capacity * sizeof(uint16_t));
+            if (log != nullptr) {
+                reclaimer.retire([log] { delete[] log; },
+                                 ref->log_capacity * sizeof(uint16_t));
             }
+            ref->log_capacity = capacity;
+            log = grown;
         }
-        if (temp_refp == nullptr) return false;
-
-        CompressedBitmap *temp_compressed_bitmap =
-            temp_refp->first_compressed_bitmap.load();
-
-        while (temp_compressed_bitmap != nullptr) {
-            if (require_csn == temp_compressed_bitmap->bitmap_csn) {
-                decompress_bitmap(bitmap_result,
-                                  temp_refp->complete_bitmap,
-                                  temp_compressed_bitmap->compressed_bitmap,
-                                  temp_compressed_bitmap->is_compressed);
-                return true;
-            }
-            temp_compressed_bitmap = temp_compressed_bitmap->next_bitmap.load();
+        if (!positions.empty()) {
+            memcpy(log + ref->log_len, positions.data(), positions.size() * sizeof(uint16_t));
         }
-        return false;
+        ref->log_len = needed;
     }
 
     /**
-     * Stage 1: insert a placeholder bitmap version.
-     * The placeholder reserves the correct position in the version chain.
+     * Position tree mode: re-encode the published versions directly after
+     * the tree tail, oldest first, stopping at the first placeholder.
+     * Each sparse diff of at least PTREE_MIN_POSITIONS positions becomes
+     * a tree built from the tail tree by flipping only the positions in
+     * which the two differ.  A tree whose new nodes take more bytes than
+     * the array is dropped again, unless it is the group's first: deltas
+     * spread over most leaves gain nothing from sharing.  Smaller diffs
+     * and other encodings keep their diff.  Called under ref_lock, after the union
+     * cascade, which only touches versions newer than a placeholder.
      */
-    bool insert_null(int new_csn,
-                     uint8_t *original_bitmap,
-                     BitmapRef *&ref,
-                     CompressedBitmap *&bitmap) {
-        bool create_ref = false;
-        BitmapRef *now_first_ref = nullptr;
-
-        head_bitmap_cnt_lock.lock();
-        if (head_bitmap_cnt == MAX_COMPRESS_NUM) {
-            head_bitmap_cnt = 1;
-            create_ref = true;
-        } else {
-            head_bitmap_cnt++;
-            now_first_ref = first_ref.load();
+    void advance_position_tree(BitmapRef *ref) {
+        std::vector<CompressedBitmap *> newer;
+        for (CompressedBitmap *node = node_at(ref->first_compressed_bitmap.load());
+             node != nullptr && node->bitmap_csn > ref->ptree_tail_csn;
+             node = node_at(node->next_bitmap.load())) {
+            newer.push_back(node);
         }
-        head_bitmap_cnt_lock.unlock();
-
-        if (create_ref) {
-            BitmapRef *new_ref = new BitmapRef();
-            new_ref->csn_range.first = new_csn;
-            new_ref->csn_range.second = new_csn;
-            new_ref->bitmap_cnt++;
-            new_ref->complete_bitmap = new uint8_t[BITMAP_SIZE];
-            memcpy(new_ref->complete_bitmap, original_bitmap, BITMAP_SIZE);
 
-            CompressedBitmap *new_compressed_bitmap = new CompressedBitmap();
-            new_compressed_bitmap->bitmap_csn = new_csn;
-            new_compressed_bitmap->compressed_bitmap = new uint16_t[1];
-            new_compressed_bitmap->compressed_bitmap[0] = 0;
-            new_compressed_bitmap->is_compressed = true;
+        std::vector<uint16_t> toggles;
+        for (auto it = newer.rbegin(); it != newer.rend(); ++it) {
+            CompressedBitmap *node = *it;
+            if (!node->is_ready()) return;
+            ref->ptree_tail_csn = node->bitmap_csn;
+            DiffView diff = node->load_diff();
+            if (diff.encoding != ENC_SPARSE || diff.data[0] < PTREE_MIN_POSITIONS) continue;
 
-            new_ref->first_compressed_bitmap.store(new_compressed_bitmap);
-
-            head_lock.lock();
-            new_ref->next_ref = first_ref.load();
-            first_ref.store(new_ref);
-            head_lock.unlock();
+            if (ref->ptree_pool == nullptr) {
+                ref->ptree_pool = new PtreePool();
+                account_memory(sizeof(PtreePool));
+            }
+            size_t nodes_before = ref->ptree_pool->nodes();
+            size_t pool_bytes = ref->ptree_pool->bytes();
+            ptree_toggles(ref->ptree_tail_root, diff.data + 1, diff.data[0], toggles);
+            const PtreeNode *root = ptree_apply(ref->ptree_tail_root, toggles, *ref->ptree_pool);
+            size_t new_nodes = ref->ptree_pool->nodes() - nodes_before;
+            bool dropped = ref->ptree_tail_root != nullptr &&
+                           new_nodes * sizeof(PtreeNode) > diff_bytes(diff);
+            if (dropped) ref->ptree_pool->rollback(nodes_before);
+            // Charge every chunk the pool still holds after this step,
+            // whether the tree was kept or rolled back.
+            account_memory(ref->ptree_pool->bytes() - pool_bytes);
+            if (dropped) continue;
+            ptree_nodes.fetch_add(new_nodes);
+            ref->ptree_tail_root = root;
 
-            return true;
+            DiffView tree_diff;
+            tree_diff.data = new uint16_t[sizeof(root) / sizeof(uint16_t)];
+            memcpy(tree_diff.data, &root, sizeof(root));
+            tree_diff.encoding = ENC_PTREE;
+            tree_diff.length = diff.length;
+            node->set_diff(tree_diff);
+            account_memory(diff_bytes(tree_diff));
+            ptree_versions.fetch_add(1);
+            ptree_positions.fetch_add(diff.data[0]);
+            uint16_t *old_data = diff.data;
+            reclaimer.retire([old_data] { delete[] old_data; }, diff_bytes(diff));
         }
+    }
 
-        CompressedBitmap *new_compressed_bitmap = new CompressedBitmap();
-        new_compressed_bitmap->bitmap_csn = new_csn;
-
-        now_first_ref->ref_lock.lock();
-        new_compressed_bitmap->next_bitmap =
-            now_first_ref->first_compressed_bitmap.load();
-        now_first_ref->first_compressed_bitmap.store(new_compressed_bitmap);
-        now_first_ref->ref_lock.unlock();
+    static const PtreeNode *ptree_root(const DiffView &diff) {
+        const PtreeNode *root;
+        memcpy(&root, diff.data, sizeof(root));
+        return root;
+    }
 
-        ref = now_first_ref;
-        bitmap = new_compressed_bitmap;
-        return true;
+    /**
+     * Call fn for every leaf of a tree in position order, until it
+     * returns false.
+     */
+    template <class Fn>
+    static void for_each_ptree_leaf(const PtreeNode *root, Fn fn) {
+        if (root == nullptr) return;
+        const PtreeNode *stack[16];
+        int next[16];
+        int depth = 0;
+        stack[0] = root;
+        next[0] = 0;
+        while (depth >= 0) {
+            const PtreeNode *node = stack[depth];
+            if (node->leaf) {
+                if (!fn(node)) return;
+                depth--;
+            } else if (next[depth] < node->count) {
+                stack[depth + 1] = node->children[next[depth]++];
+                next[++depth] = 0;
+            } else {
+                depth--;
+            }
+        }
     }
 
     /**
-     * Stage 2 & 3: fill placeholder and update visibility range.
+     * Positions in which a tree and a sorted position array differ.  A
+     * leaf equal to the next block of the array is skipped with one
+     * compare, so only the blocks around changes are merged.
      */
-    bool insert_bitmap_content(BitmapRef *ref,
-                               CompressedBitmap *bitmap,
-                               uint8_t *original_bitmap) {
-        bitmap->compressed_bitmap =
-            compress_bitmap(original_bitmap,
-                            ref->complete_bitmap,
-                            bitmap->is_compressed);
+    static void ptree_toggles(const PtreeNode *root, const uint16_t *positions, int n,
+                              std::vector<uint16_t> &toggles) {
+        toggles.clear();
+        int j = 0;
+        for_each_ptree_leaf(root, [&](const PtreeNode *leaf) {
+            int cnt = leaf->count;
+            if (j + cnt <= n &&
+                memcmp(leaf->positions, positions + j, cnt * sizeof(uint16_t)) == 0) {
+                j += cnt;
+                return true;
+            }
+            int i = 0;
+            while (i < cnt) {
+                if (j < n && positions[j] < leaf->positions[i]) {
+                    toggles.push_back(positions[j++]);
+                } else if (j < n && positions[j] == leaf->positions[i]) {
+                    i++;
+                    j++;
+                } else {
+                    toggles.push_back(leaf->positions[i++]);
+                }
+            }
+            return true;
+        });
+        toggles.insert(toggles.end(), positions + j, positions + n);
+    }
 
-        ref->ref_lock.lock();
-        ref->bitmap_cnt++;
+    /**
+     * Root of the tree that differs from root exactly in the sorted
+     * positions toggles.  Copies the paths to the changed leaves and
+     * shares everything else; returns null for an empty tree.
+     */
+    const PtreeNode *ptree_apply(const PtreeNode *root, const std::vector<uint16_t> &toggles,
+                                 PtreePool &pool) {
+        if (toggles.empty()) return root;
+        std::vector<const PtreeNode *> level;
+        ptree_update(root, toggles.data(), (int)toggles.size(), pool, level);
+        while (level.size() > 1) {
+            std::vector<const PtreeNode *> parents;
+            ptree_emit_inner(level, pool, parents);
+            level.swap(parents);
+        }
+        const PtreeNode *result = level.empty() ? nullptr : level[0];
+        while (result != nullptr && !result->leaf && result->count == 1) {
+            result = result->children[0];
+        }
+        return result;
+    }
 
-        CompressedBitmap *temp_bmp = ref->first_compressed_bitmap.load();
-        CompressedBitmap *start_compress_point = nullptr;
-        int temp_csn = -1;
+    /**
+     * Append to out the nodes that replace node once toggles[0, n) are
+     * flipped in it: zero nodes if it empties, several if it overflows.
+     * Replacements are at the height of node; a null node is an empty
+     * leaf.
+     */
+    void ptree_update(const PtreeNode *node, const uint16_t *toggles, int n, PtreePool &pool,
+                      std::vector<const PtreeNode *> &out) {
+        if (node == nullptr || node->leaf) {
+            std::vector<uint16_t> merged;
+            int cnt = node == nullptr ? 0 : node->count;
+            merged.reserve(cnt + n);
+            int i = 0;
+            int j = 0;
+            while (i < cnt || j < n) {
+                if (j == n || (i < cnt && node->positions[i] < toggles[j])) {
+                    merged.push_back(node->positions[i++]);
+                } else if (i == cnt || toggles[j] < node->positions[i]) {
+                    merged.push_back(toggles[j++]);
+                } else {
+                    i++;
+                    j++;
+                }
+            }
+            ptree_emit_leaves(merged.data(), (int)merged.size(), pool, out);
+            return;
+        }
 
-        while (temp_bmp != nullptr && temp_bmp != bitmap) {
-            if (temp_bmp->compressed_bitmap == nullptr) {
-                temp_csn = -1;
-                start_compress_point = nullptr;
+        std::vector<const PtreeNode *> children;
+        int j = 0;
+        for (int c = 0; c < node->count; c++) {
+            int end = n;
+            if (c + 1 < node->count) {
+                end = j;
+                while (end < n && toggles[end] < node->children[c + 1]->first) end++;
+            }
+            if (end == j) {
+                children.push_back(node->children[c]);
             } else {
-                temp_csn = temp_bmp->bitmap_csn;
-                start_compress_point = temp_bmp;
+                ptree_update(node->children[c], toggles + j, end - j, pool, children);
             }
-            temp_bmp = temp_bmp->next_bitmap.load();
+            j = end;
         }
-
-        if (start_compress_point != nullptr) {
-            temp_bmp = start_compress_point;
-            while (temp_bmp != nullptr && temp_bmp != bitmap) {
-                union_sorted_array(temp_bmp->compressed_bitmap,
-                                   bitmap->compressed_bitmap);
-                temp_bmp = temp_bmp->next_bitmap.load();
+        // Merge a leaf left nearly empty by clears into its neighbour.
+        for (size_t c = 0; c + 1 < children.size(); c++) {
+            const PtreeNode *a = children[c];
+            const PtreeNode *b = children[c + 1];
+            if (!a->leaf || a->size + b->size > (uint32_t)PTREE_LEAF_POSITIONS ||
+                (a->size >= PTREE_LEAF_POSITIONS / 4 && b->size >= PTREE_LEAF_POSITIONS / 4)) {
+                continue;
             }
+            uint16_t merged[PTREE_LEAF_POSITIONS];
+            memcpy(merged, a->positions, a->count * sizeof(uint16_t));
+            memcpy(merged + a->count, b->positions, b->count * sizeof(uint16_t));
+            std::vector<const PtreeNode *> one;
+            ptree_emit_leaves(merged, a->count + b->count, pool, one);
+            children[c] = one[0];
+            children.erase(children.begin() + c + 1);
         }
+        ptree_emit_inner(children, pool, out);
+    }
 
-        if (temp_csn == -1) {
-            temp_csn = bitmap->bitmap_csn;
+    /**
+     * Pack sorted positions into evenly filled leaves.
+     */
+    void ptree_emit_leaves(const uint16_t *positions, int n, PtreePool &pool,
+                           std::vector<const PtreeNode *> &out) {
+        int leaves = (n + PTREE_LEAF_POSITIONS - 1) / PTREE_LEAF_POSITIONS;
+        for (int k = 0, begin = 0; k < leaves; k++) {
+            int end = (int)((int64_t)n * (k + 1) / leaves);
+            PtreeNode *leaf = pool.alloc();
+            leaf->leaf = true;
+            leaf->count = (uint8_t)(end - begin);
+            leaf->size = end - begin;
+            leaf->first = positions[begin];
+            memcpy(leaf->positions, positions + begin, (end - begin) * sizeof(uint16_t));
+            out.push_back(leaf);
+            begin = end;
         }
-        ref->csn_range.second =
-            std::max(ref->csn_range.second, temp_csn);
+    }
 
-        ref->ref_lock.unlock();
-        return true;
+    /**
+     * Pack same-height nodes into evenly filled parents.
+     */
+    void ptree_emit_inner(const std::vector<const PtreeNode *> &children, PtreePool &pool,
+                          std::vector<const PtreeNode *> &out) {
+        int n = (int)children.size();
+        int parents = (n + PTREE_FANOUT - 1) / PTREE_FANOUT;
+        for (int k = 0, begin = 0; k < parents; k++) {
+            int end = (int)((int64_t)n * (k + 1) / parents);
+            PtreeNode *inner = pool.alloc();
+            inner->leaf = false;
+            inner->count = (uint8_t)(end - begin);
+            inner->size = 0;
+            inner->first = children[begin]->first;
+            for (int c = begin; c < end; c++) {
+                inner->children[c - begin] = children[c];
+                inner->size += children[c]->size;
+            }
+            out.push_back(inner);
+            begin = end;
+        }
     }
 
-  private:
-    std::atomic<BitmapRef*> first_ref = nullptr;   // Head of reference chain
-    std::mutex head_lock;
-    std::mutex head_bitmap_cnt_lock;
-    int head_bitmap_cnt = 0;
+    void start_pipeline() {
+        diff_queue = new BoundedMpmcQueue<CommitJob>(config.pipeline_queue_capacity);
+        publish_queue = new BoundedMpmcQueue<CommitJob>(config.pipeline_queue_capacity);
+        pipeline_running.store(true);
+        int workers = std::max(1, config.pipeline_workers);
+        for (int i = 0; i < workers; i++) {
+            pipeline_threads.emplace_back([this] { pipeline_loop(); });
+        }
+    }
 
-    std::thread worker;
-    std::vector<int>& tsn_list;
-    std::atomic<bool> stop_flag;
-    std::mutex mtx;
+    void stop_pipeline() {
+        if (!pipeline_running.load()) return;
+        drain_pipeline();
+        pipeline_running.store(false);
+        for (auto &t : pipeline_threads) t.join();
+        pipeline_threads.clear();
+        delete diff_queue;
+        delete publish_queue;
+        diff_queue = nullptr;
+        publish_queue = nullptr;
+    }
+
+    /**
+     * Pipeline worker.  Downstream work is drained first so that
+     * published versions are not held back by new submissions.
+     */
+    void pipeline_loop() {
+        int idle = 0;
+        CommitJob job;
+        while (pipeline_running.load()) {
+            if (publish_queue->try_pop(job)) {
+                stage_consolidate_and_publish(job.ref, job.bitmap);
+                qos.record_commit((int64_t)(now_ns() - job.submit_ns));
+                pipeline_completed.fetch_add(1);
+                idle = 0;
+            } else if (diff_queue->try_pop(job)) {
+                job.diff = stage_diff(job.ref, job.staged_bitmap, job.bitmap_len);
+                delete[] job.staged_bitmap;
+                job.staged_bitmap = nullptr;
+                stage_link(job.bitmap, job.diff);
+                while (!publish_queue->try_push(job)) {
+                    std::this_thread::yield();
+                }
+                idle = 0;
+            } else if (++idle < 64) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
 
     void delete_middle_ref(BitmapRef *ref_front,
                            BitmapRef *temp_ref_back) {
@@ -349,8 +3783,9 @@ class BitmapController {
         CompressedBitmap *del_bmp = nullptr;
         while (temp_bmp_back != bitmap_front && temp_bmp_back != nullptr) {
             del_bmp = temp_bmp_back;
-            temp_bmp_back = temp_bmp_back->next_bitmap.load();
-            delete del_bmp;
+            temp_bmp_back = node_at(temp_bmp_back->next_bitmap.load());
+            delete[] del_bmp->diff();
+            del_bmp->mark_dead();
         }
     }
 
@@ -0,0 +1,268 @@
+#ifndef LOCK_PROFILER_H
+#define LOCK_PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Per-site lock contention profiling.
+ *
+ * Controllers declare their locks as SiteLock<Mutex> with a site name.
+ * Without Lock_Profile a SiteLock is the plain mutex.  With Lock_Profile
+ * every acquisition records its wait time and hold time into log2
+ * histograms shared by all locks of the same site, e.g. all ref_locks.
+ */
+
+const int LOCK_HIST_BUCKETS = 32;                        // Bucket i holds durations in [2^i, 2^(i+1)) ns
+
+/**
+ * Counters of a lock site at one point in time.
+ */
+struct LockSiteSnapshot {
+    std::string name;
+    uint64_t acquisitions = 0;                            // Exclusive and shared acquisitions
+    uint64_t contended = 0;                               // Acquisitions that had to wait
+    uint64_t wait_ns = 0;                                 // Total wait time
+    uint64_t hold_ns = 0;                                 // Total hold time
+    uint64_t wait_hist[LOCK_HIST_BUCKETS] = {};
+    uint64_t hold_hist[LOCK_HIST_BUCKETS] = {};
+
+    /**
+     * Upper bound of the bucket containing quantile q.
+     */
+    static uint64_t quantile(const uint64_t *hist, double q) {
+        uint64_t total = 0;
+        for (int i = 0; i < LOCK_HIST_BUCKETS; i++) total += hist[i];
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t)(q * (total - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < LOCK_HIST_BUCKETS; i++) {
+            seen += hist[i];
+            if (seen >= rank) return 1ull << (i + 1);
+        }
+        return 1ull << LOCK_HIST_BUCKETS;
+    }
+
+    void print(std::ostream &os) const {
+        double avg_wait = acquisitions ? (double)wait_ns / acquisitions : 0.0;
+        double avg_hold = acquisitions ? (double)hold_ns / acquisitions : 0.0;
+        os << "  " << name << ": acquisitions " << acquisitions
+           << ", contended " << contended
+           << ", wait avg " << avg_wait << " ns p50<" << quantile(wait_hist, 0.5)
+           << " p99<" << quantile(wait_hist, 0.99)
+           << ", hold avg " << avg_hold << " ns p50<" << quantile(hold_hist, 0.5)
+           << " p99<" << quantile(hold_hist, 0.99) << std::endl;
+    }
+};
+
+#ifdef Lock_Profile
+
+/**
+ * Live counters of a lock site.
+ */
+struct LockSiteStats {
+    std::string name;
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> wait_ns{0};
+    std::atomic<uint64_t> hold_ns{0};
+    std::atomic<uint64_t> wait_hist[LOCK_HIST_BUCKETS] = {};
+    std::atomic<uint64_t> hold_hist[LOCK_HIST_BUCKETS] = {};
+
+    explicit LockSiteStats(const char *site_name) : name(site_name) {}
+
+    static int bucket(uint64_t ns) {
+        int b = 63 - __builtin_clzll(ns | 1);
+        return b < LOCK_HIST_BUCKETS ? b : LOCK_HIST_BUCKETS - 1;
+    }
+
+    void record_wait(uint64_t ns, bool was_contended) {
+        acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (was_contended) contended.fetch_add(1, std::memory_order_relaxed);
+        wait_ns.fetch_add(ns, std::memory_order_relaxed);
+        wait_hist[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_hold(uint64_t ns) {
+        hold_ns.fetch_add(ns, std::memory_order_relaxed);
+        hold_hist[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    LockSiteSnapshot snapshot() const {
+        LockSiteSnapshot snap;
+        snap.name = name;
+        snap.acquisitions = acquisitions.load();
+        snap.contended = contended.load();
+        snap.wait_ns = wait_ns.load();
+        snap.hold_ns = hold_ns.load();
+        for (int i = 0; i < LOCK_HIST_BUCKETS; i++) {
+            snap.wait_hist[i] = wait_hist[i].load();
+            snap.hold_hist[i] = hold_hist[i].load();
+        }
+        return snap;
+    }
+};
+
+/**
+ * Process-wide registry of lock sites, keyed by name.
+ */
+class LockSiteRegistry {
+  public:
+    static LockSiteRegistry &instance() {
+        static LockSiteRegistry registry;
+        return registry;
+    }
+
+    LockSiteStats *site(const char *name) {
+        std::lock_guard<std::mutex> lk(registry_lock);
+        for (auto &s : sites) {
+            if (s.name == name) return &s;
+        }
+        sites.emplace_back(name);
+        return &sites.back();
+    }
+
+    std::vector<LockSiteSnapshot> snapshot() {
+        std::lock_guard<std::mutex> lk(registry_lock);
+        std::vector<LockSiteSnapshot> result;
+        for (auto &s : sites) result.push_back(s.snapshot());
+        return result;
+    }
+
+  private:
+    std::mutex registry_lock;
+    std::deque<LockSiteStats> sites;                      // deque keeps site addresses stable
+};
+
+static inline uint64_t lock_profile_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Start times of shared holds of the current thread, which can
+ * overlap across threads and therefore cannot live in the lock.
+ */
+struct SharedHoldStack {
+    static const int MAX_DEPTH = 16;
+    const void *lock[MAX_DEPTH];
+    uint64_t since[MAX_DEPTH];
+    int depth = 0;
+
+    void push(const void *l, uint64_t ts) {
+        if (depth < MAX_DEPTH) {
+            lock[depth] = l;
+            since[depth] = ts;
+        }
+        depth++;
+    }
+
+    uint64_t pop(const void *l) {
+        depth--;
+        for (int i = std::min(depth, MAX_DEPTH - 1); i >= 0; i--) {
+            if (lock[i] == l) {
+                uint64_t ts = since[i];
+                lock[i] = nullptr;
+                return ts;
+            }
+        }
+        return 0;
+    }
+};
+
+static inline SharedHoldStack &shared_hold_stack() {
+    thread_local SharedHoldStack stack;
+    return stack;
+}
+
+/**
+ * A mutex that records its acquisitions into a lock site.
+ */
+template <class Mutex>
+class SiteLock {
+  public:
+    explicit SiteLock(const char *site_name)
+        : site(LockSiteRegistry::instance().site(site_name)) {}
+
+    void lock() {
+        uint64_t ts = lock_profile_now_ns();
+        bool was_contended = !mtx.try_lock();
+        if (was_contended) mtx.lock();
+        uint64_t acquired = lock_profile_now_ns();
+        site->record_wait(acquired - ts, was_contended);
+        held_since = acquired;
+    }
+
+    bool try_lock() {
+        if (!mtx.try_lock()) return false;
+        uint64_t acquired = lock_profile_now_ns();
+        site->record_wait(0, false);
+        held_since = acquired;
+        return true;
+    }
+
+    void unlock() {
+        uint64_t held = lock_profile_now_ns() - held_since;
+        mtx.unlock();
+        site->record_hold(held);
+    }
+
+    void lock_shared() {
+        uint64_t ts = lock_profile_now_ns();
+        bool was_contended = !mtx.try_lock_shared();
+        if (was_contended) mtx.lock_shared();
+        uint64_t acquired = lock_profile_now_ns();
+        site->record_wait(acquired - ts, was_contended);
+        shared_hold_stack().push(this, acquired);
+    }
+
+    void unlock_shared() {
+        uint64_t since = shared_hold_stack().pop(this);
+        uint64_t held = since ? lock_profile_now_ns() - since : 0;
+        mtx.unlock_shared();
+        site->record_hold(held);
+    }
+
+  private:
+    Mutex mtx;
+    LockSiteStats *site;
+    uint64_t held_since = 0;                              // Written only by the exclusive owner
+};
+
+static inline std::vector<LockSiteSnapshot> collect_lock_profile() {
+    return LockSiteRegistry::instance().snapshot();
+}
+
+#else
+
+/**
+ * Profiling disabled: a SiteLock is the plain mutex.
+ */
+template <class Mutex>
+class SiteLock : public Mutex {
+  public:
+    explicit SiteLock(const char *) {}
+};
+
+static inline std::vector<LockSiteSnapshot> collect_lock_profile() {
+    return std::vector<LockSiteSnapshot>();
+}
+
+#endif // Lock_Profile
+
+static inline void print_lock_profile(std::ostream &os,
+                                      const std::vector<LockSiteSnapshot> &sites) {
+    if (sites.empty()) return;
+    os << "lock profile:" << std::endl;
+    for (const auto &site : sites) site.print(os);
+}
+
+#endif // LOCK_PROFILER_H
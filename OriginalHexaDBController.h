@@ -9,6 +9,9 @@
 #include <chrono>
 #include <shared_mutex>
 
+#include "LockProfiler.h"
+#include "TimeCsnIndex.h"
+
 #endif // BITMAPCONTROLLER_H
 
 const int BITMAP_SIZE = 7500;
@@ -70,6 +73,7 @@ public:
      */
     bool insert_bitmap_content(uint8_t *new_content, OneBitmap *bitmap) {
         memcpy(bitmap->bitmap_content, new_content, BITMAP_SIZE);
+        time_index.record_now(bitmap->bitmap_csn);
         return true;
     }
 
@@ -98,13 +102,24 @@ public:
         }
     }
 
+    /**
+     * Retrieve the bitmap as of a wall-clock time (microseconds since
+     * the epoch), resolved through the time-to-CSN index.
+     */
+    bool get_bitmap_at_time(int64_t ts_us, uint8_t *require_content) {
+        int csn = 0;
+        if (!time_index.lookup(ts_us, csn)) return false;
+        return get_bitmap(csn, require_content);
+    }
+
 private:
     OneBitmap *first_bitmap = nullptr;          // Head of the bitmap version chain
-    std::shared_mutex chain_lock;               // Reader-writer lock for version chain
+    SiteLock<std::shared_mutex> chain_lock{"chain_lock"}; // Reader-writer lock for version chain
 
     std::thread worker;
     std::vector<int>& tsn_list;                 // Active transaction CSNs
     std::atomic<bool> stop_flag;
+    TimeCsnIndex time_index;                    // Wall-clock to CSN samples
 
     /**
      * Garbage collection based on the oldest active transaction policy.
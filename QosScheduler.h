@@ -0,0 +1,177 @@
+#ifndef QOS_SCHEDULER_H
+#define QOS_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+/**
+ * Priority classes of controller work.
+ */
+enum QosClass {
+    QOS_COMMIT = 0,                                      // OLTP commits, never delayed
+    QOS_READ = 1,                                        // Point snapshot reads, never delayed
+    QOS_ANALYTIC = 2,                                    // Bulk and historical materialization, paced
+    QOS_BACKGROUND = 3,                                  // GC slices, yield to commits
+    QOS_CLASS_NUM = 4
+};
+
+/**
+ * Counters of a QoS scheduler at one point in time.
+ */
+struct QosStats {
+    bool enabled = false;
+    int64_t commit_latency_target_ns = 0;
+    int64_t commit_latency_ewma_ns = 0;                   // Smoothed commit latency
+    uint64_t commits = 0;
+    uint64_t background_slices = 0;                       // Yield points reached by background work
+    uint64_t background_yields = 0;                       // Slices that had to wait
+    uint64_t background_wait_ns = 0;
+    uint64_t analytic_requests = 0;
+    uint64_t analytic_throttled = 0;                      // Requests that had to wait
+    uint64_t analytic_wait_ns = 0;
+
+    void print(std::ostream &os) const {
+        if (!enabled) return;
+        os << "qos: commit latency ewma " << commit_latency_ewma_ns << " ns (target "
+           << commit_latency_target_ns << "), background yields " << background_yields
+           << "/" << background_slices << " (" << background_wait_ns / 1000 << " us)"
+           << ", analytic throttled " << analytic_throttled << "/" << analytic_requests
+           << " (" << analytic_wait_ns / 1000 << " us)" << std::endl;
+    }
+};
+
+/**
+ * Commit-latency driven scheduler for controller work.
+ *
+ * Commits report their latency, which feeds an EWMA.  While the EWMA is
+ * above the target the controller is overloaded: background work waits
+ * at its yield points with exponential backoff (bounded, so it always
+ * makes progress), and analytical reads are paced to a fixed rate.
+ * Commits and point reads are never delayed.  A latency sample older
+ * than a few targets no longer counts, so an idle system is never
+ * considered overloaded.
+ */
+class QosScheduler {
+  public:
+    QosScheduler(int64_t commit_latency_target_ns_ref,
+                 double analytic_overload_rate_ref,
+                 int max_background_delay_ms_ref)
+        : target_ns(commit_latency_target_ns_ref),
+          analytic_interval_ns(analytic_overload_rate_ref > 0
+                                   ? (int64_t)(1e9 / analytic_overload_rate_ref) : 0),
+          max_background_delay_ns((int64_t)max_background_delay_ms_ref * 1000000) {}
+
+    bool enabled() const { return target_ns > 0; }
+
+    /**
+     * Feed one commit latency sample (EWMA with weight 1/8).
+     */
+    void record_commit(int64_t latency_ns) {
+        if (!enabled()) return;
+        commits.fetch_add(1, std::memory_order_relaxed);
+        last_commit_ns.store(now_ns(), std::memory_order_relaxed);
+        int64_t cur = ewma_ns.load(std::memory_order_relaxed);
+        while (!ewma_ns.compare_exchange_weak(cur, cur + (latency_ns - cur) / 8,
+                                              std::memory_order_relaxed)) {}
+    }
+
+    bool overloaded() const {
+        if (!enabled()) return false;
+        int64_t stale_ns = std::max<int64_t>(8 * target_ns, 10000000);
+        return ewma_ns.load(std::memory_order_relaxed) > target_ns &&
+               now_ns() - last_commit_ns.load(std::memory_order_relaxed) < stale_ns;
+    }
+
+    /**
+     * Yield point of background work, called between slices and never
+     * while holding a controller lock.
+     */
+    void background_yield() {
+        if (!enabled()) return;
+        background_slices.fetch_add(1, std::memory_order_relaxed);
+        if (!overloaded()) return;
+        int64_t start = now_ns();
+        int64_t backoff_us = 50;
+        while (overloaded() && now_ns() - start < max_background_delay_ns) {
+            std::this_thread::sleep_for(std::chrono::microseconds(backoff_us));
+            backoff_us = std::min<int64_t>(backoff_us * 2, 5000);
+        }
+        background_yields.fetch_add(1, std::memory_order_relaxed);
+        background_wait_ns.fetch_add(now_ns() - start, std::memory_order_relaxed);
+    }
+
+    /**
+     * Admit an analytical request that materializes cost versions.
+     * While overloaded, requests are spaced to the configured rate.  The
+     * backlog of slots is capped at max_background_delay_ns and dropped
+     * once the overload ends, so past bursts never delay later requests.
+     */
+    void admit_analytic(int cost) {
+        if (!enabled()) return;
+        analytic_requests.fetch_add(1, std::memory_order_relaxed);
+        if (analytic_interval_ns == 0) return;
+        if (!overloaded()) {
+            std::lock_guard<std::mutex> lk(pace_lock);
+            next_analytic_ns = 0;
+            return;
+        }
+        int64_t wait_ns;
+        {
+            std::lock_guard<std::mutex> lk(pace_lock);
+            int64_t now = now_ns();
+            int64_t slot = std::min(std::max(next_analytic_ns, now), now + max_background_delay_ns);
+            next_analytic_ns = std::min(slot + cost * analytic_interval_ns,
+                                        now + max_background_delay_ns);
+            wait_ns = slot - now;
+        }
+        if (wait_ns <= 0) return;
+        std::this_thread::sleep_for(std::chrono::nanoseconds(wait_ns));
+        analytic_throttled.fetch_add(1, std::memory_order_relaxed);
+        analytic_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+    }
+
+    QosStats get_stats() const {
+        QosStats stats;
+        stats.enabled = enabled();
+        stats.commit_latency_target_ns = target_ns;
+        stats.commit_latency_ewma_ns = ewma_ns.load();
+        stats.commits = commits.load();
+        stats.background_slices = background_slices.load();
+        stats.background_yields = background_yields.load();
+        stats.background_wait_ns = background_wait_ns.load();
+        stats.analytic_requests = analytic_requests.load();
+        stats.analytic_throttled = analytic_throttled.load();
+        stats.analytic_wait_ns = analytic_wait_ns.load();
+        return stats;
+    }
+
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+  private:
+    int64_t target_ns;                                    // 0 disables the scheduler
+    int64_t analytic_interval_ns;                         // Spacing per analytical version
+    int64_t max_background_delay_ns;                      // Longest wait per yield or request
+
+    std::atomic<int64_t> ewma_ns{0};
+    std::atomic<int64_t> last_commit_ns{0};
+    std::mutex pace_lock;
+    int64_t next_analytic_ns = 0;                         // Next free analytical slot
+
+    std::atomic<uint64_t> commits{0};
+    std::atomic<uint64_t> background_slices{0};
+    std::atomic<uint64_t> background_yields{0};
+    std::atomic<uint64_t> background_wait_ns{0};
+    std::atomic<uint64_t> analytic_requests{0};
+    std::atomic<uint64_t> analytic_throttled{0};
+    std::atomic<uint64_t> analytic_wait_ns{0};
+};
+
+#endif // QOS_SCHEDULER_H
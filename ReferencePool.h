@@ -0,0 +1,173 @@
+#ifndef REFERENCE_POOL_H
+#define REFERENCE_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Content of a reference bitmap that reads can produce without a copy.
+ */
+enum ReferenceFill : uint8_t {
+    FILL_NONE = 0,                                        // Arbitrary content
+    FILL_ZEROS = 1,                                       // All bits clear
+    FILL_ONES = 2                                         // All bits of the logical length set
+};
+
+/**
+ * Counters of the reference pool at one point in time.
+ */
+struct ReferencePoolStats {
+    size_t pages = 0;                                     // Distinct interned references
+    size_t page_bytes = 0;                                // Bytes held by them
+    size_t references = 0;                                // Groups pointing at them
+    uint64_t hits = 0;                                    // Interns that found an existing page
+
+    void print(std::ostream &os) const {
+        if (pages == 0) return;
+        os << "reference pool: " << pages << " pages (" << page_bytes << " bytes) for "
+           << references << " groups, " << hits << " hits" << std::endl;
+    }
+};
+
+/**
+ * Process-wide hash-consing of group reference bitmaps.
+ *
+ * Groups whose references are byte-identical, e.g. the all-zeros state
+ * of freshly loaded row groups, share one read-only page.  Pages are
+ * reference counted and freed when the last group releases them.
+ * Interning happens once per group, so a single mutex suffices.
+ */
+class ReferencePool {
+  public:
+    static ReferencePool &instance() {
+        static ReferencePool pool;
+        return pool;
+    }
+
+    ReferencePool(const ReferencePool &) = delete;
+    ReferencePool &operator=(const ReferencePool &) = delete;
+
+    /**
+     * Return the shared page holding the capacity bytes at bitmap,
+     * creating it if needed.  The caller owns one reference.
+     */
+    const uint8_t *intern(const uint8_t *bitmap, int capacity) {
+        uint64_t hash = hash_bytes(bitmap, capacity);
+        std::lock_guard<std::mutex> lk(pool_lock);
+        auto range = by_hash.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            Page *page = it->second;
+            if (page->capacity == capacity && memcmp(page->data, bitmap, capacity) == 0) {
+                page->refs++;
+                hits++;
+                return page->data;
+            }
+        }
+        Page *page = new Page();
+        page->data = new uint8_t[capacity];
+        memcpy(page->data, bitmap, capacity);
+        page->capacity = capacity;
+        page->hash = hash;
+        page->refs = 1;
+        by_hash.emplace(hash, page);
+        by_data.emplace(page->data, page);
+        page_bytes += capacity;
+        return page->data;
+    }
+
+    /**
+     * Take another reference to an interned page.
+     */
+    void acquire(const uint8_t *data) {
+        std::lock_guard<std::mutex> lk(pool_lock);
+        by_data.at(data)->refs++;
+    }
+
+    /**
+     * Drop a reference; the page is freed with its last one.
+     */
+    void release(const uint8_t *data) {
+        std::lock_guard<std::mutex> lk(pool_lock);
+        auto it = by_data.find(data);
+        if (it == by_data.end()) return;
+        Page *page = it->second;
+        if (--page->refs > 0) return;
+        by_data.erase(it);
+        auto range = by_hash.equal_range(page->hash);
+        for (auto h = range.first; h != range.second; ++h) {
+            if (h->second == page) {
+                by_hash.erase(h);
+                break;
+            }
+        }
+        page_bytes -= page->capacity;
+        delete[] page->data;
+        delete page;
+    }
+
+    /**
+     * Bytes held by all pages, without taking the pool lock.
+     */
+    size_t get_page_bytes() const {
+        return page_bytes.load(std::memory_order_relaxed);
+    }
+
+    ReferencePoolStats get_stats() {
+        std::lock_guard<std::mutex> lk(pool_lock);
+        ReferencePoolStats stats;
+        stats.pages = by_data.size();
+        stats.page_bytes = page_bytes;
+        for (const auto &entry : by_data) stats.references += entry.second->refs;
+        stats.hits = hits;
+        return stats;
+    }
+
+    /**
+     * Classify the first len bytes of a reference.
+     */
+    static ReferenceFill classify(const uint8_t *bitmap, int len) {
+        bool zeros = true;
+        bool ones = true;
+        for (int i = 0; i < len && (zeros || ones); i++) {
+            zeros &= bitmap[i] == 0;
+            ones &= bitmap[i] == 0xFF;
+        }
+        if (zeros) return FILL_ZEROS;
+        return ones && len > 0 ? FILL_ONES : FILL_NONE;
+    }
+
+  private:
+    struct Page {
+        uint8_t *data;
+        int capacity;
+        uint64_t hash;
+        int refs;
+    };
+
+    ReferencePool() {}
+
+    std::mutex pool_lock;
+    std::unordered_multimap<uint64_t, Page *> by_hash;
+    std::unordered_map<const uint8_t *, Page *> by_data;
+    std::atomic<size_t> page_bytes{0};
+    uint64_t hits = 0;
+
+    static uint64_t hash_bytes(const uint8_t *data, int len) {
+        uint64_t h = 0xcbf29ce484222325ull ^ (uint64_t)len;
+        int i = 0;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t w;
+            memcpy(&w, data + i, 8);
+            h = (h ^ w) * 0x100000001b3ull;
+            h ^= h >> 29;
+        }
+        for (; i < len; i++) h = (h ^ data[i]) * 0x100000001b3ull;
+        return h;
+    }
+};
+
+#endif // REFERENCE_POOL_H
@@ -0,0 +1,136 @@
+#ifndef TIME_CSN_INDEX_H
+#define TIME_CSN_INDEX_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <shared_mutex>
+#include <vector>
+
+#include "LockProfiler.h"
+
+/**
+ * Wall-clock time in microseconds since the Unix epoch.
+ */
+static inline int64_t wall_clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * One sample of the time index: by time ts_us every CSN up to csn
+ * had been published.
+ */
+struct TimeCsnEntry {
+    int64_t ts_us;
+    int csn;
+};
+
+/**
+ * Compact, monotonic wall-clock to CSN index sampled at commit.
+ *
+ * Commits in the same granularity bucket share one entry whose time is
+ * the bucket's latest commit, so a lookup never returns a CSN published
+ * after the requested time.  Timestamps and CSNs are clamped to be
+ * non-decreasing, which lets lookups binary search.
+ */
+class TimeCsnIndex {
+  public:
+    explicit TimeCsnIndex(int64_t granularity_us_ref = 1000)
+        : granularity_us(std::max<int64_t>(1, granularity_us_ref)) {}
+
+    /**
+     * Record that csn was published at ts_us.
+     */
+    void record(int64_t ts_us, int csn) {
+        std::lock_guard<SiteLock<std::shared_mutex>> lk(index_lock);
+        if (!entries.empty()) {
+            TimeCsnEntry &last = entries.back();
+            ts_us = std::max(ts_us, last.ts_us);
+            csn = std::max(csn, last.csn);
+            if (ts_us / granularity_us == last.ts_us / granularity_us) {
+                last.ts_us = ts_us;
+                last.csn = csn;
+                return;
+            }
+        }
+        entries.push_back(TimeCsnEntry{ts_us, csn});
+    }
+
+    void record_now(int csn) {
+        record(wall_clock_us(), csn);
+    }
+
+    /**
+     * Newest CSN published at or before ts_us.
+     * Returns false if ts_us precedes every sample.
+     */
+    bool lookup(int64_t ts_us, int &csn) const {
+        std::shared_lock<SiteLock<std::shared_mutex>> lk(index_lock);
+        auto it = std::upper_bound(entries.begin(), entries.end(), ts_us,
+                                   [](int64_t ts, const TimeCsnEntry &e) {
+                                       return ts < e.ts_us;
+                                   });
+        if (it == entries.begin()) return false;
+        csn = std::prev(it)->csn;
+        return true;
+    }
+
+    /**
+     * Publication time of csn: the first sample covering it.
+     * Returns false if csn is newer than every sample.
+     */
+    bool time_of(int csn, int64_t &ts_us) const {
+        std::shared_lock<SiteLock<std::shared_mutex>> lk(index_lock);
+        auto it = std::lower_bound(entries.begin(), entries.end(), csn,
+                                   [](const TimeCsnEntry &e, int c) {
+                                       return e.csn < c;
+                                   });
+        if (it == entries.end()) return false;
+        ts_us = it->ts_us;
+        return true;
+    }
+
+    /**
+     * Thin samples older than before_ts_us to the newest one per
+     * granularity bucket, keeping the index bounded under retention.
+     */
+    void thin(int64_t before_ts_us, int64_t granularity) {
+        std::lock_guard<SiteLock<std::shared_mutex>> lk(index_lock);
+        std::vector<TimeCsnEntry> kept;
+        kept.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            const TimeCsnEntry &e = entries[i];
+            bool last_in_bucket = i + 1 == entries.size() ||
+                entries[i + 1].ts_us / granularity != e.ts_us / granularity;
+            if (e.ts_us >= before_ts_us || last_in_bucket) kept.push_back(e);
+        }
+        entries.swap(kept);
+    }
+
+    /**
+     * Replace the samples with a copy of another index's.
+     */
+    void copy_from(const TimeCsnIndex &other) {
+        std::vector<TimeCsnEntry> copied;
+        {
+            std::shared_lock<SiteLock<std::shared_mutex>> lk(other.index_lock);
+            copied = other.entries;
+        }
+        std::lock_guard<SiteLock<std::shared_mutex>> lk(index_lock);
+        entries.swap(copied);
+    }
+
+    size_t size() const {
+        std::shared_lock<SiteLock<std::shared_mutex>> lk(index_lock);
+        return entries.size();
+    }
+
+  private:
+    int64_t granularity_us;
+    mutable SiteLock<std::shared_mutex> index_lock{"time_index_lock"};
+    std::vector<TimeCsnEntry> entries;
+};
+
+#endif // TIME_CSN_INDEX_H
@@ -0,0 +1,307 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Parameters of a generated version sequence.  Equal specs always
+ * produce identical workloads, on any thread count.
+ */
+struct WorkloadSpec {
+    uint64_t seed = 1;
+    int versions = 20;                                    // Versions in the sequence
+    int bitmap_len = 7500;                                // Bytes per version, BITMAP_SIZE in the benchmark
+    int bits_per_version = 1;                             // Bits newly set by each version after the first
+    int first_csn = 0;                                    // CSN of version 0; CSNs are consecutive
+
+    bool operator==(const WorkloadSpec &other) const {
+        return seed == other.seed && versions == other.versions &&
+               bitmap_len == other.bitmap_len && bits_per_version == other.bits_per_version &&
+               first_csn == other.first_csn;
+    }
+};
+
+/**
+ * On-disk layout of a cached workload: this header, versions + 1
+ * uint64_t delta offsets, then the uint16_t bit positions.
+ */
+struct WorkloadFileHeader {
+    char magic[8];
+    uint64_t seed;
+    int32_t versions;
+    int32_t bitmap_len;
+    int32_t bits_per_version;
+    int32_t first_csn;
+    uint64_t total_deltas;
+};
+
+static const char WORKLOAD_MAGIC[8] = {'H', 'D', 'W', 'L', 'O', 'A', 'D', '1'};
+
+/**
+ * Seeded, pre-generated version sequence stored as compact deltas.
+ *
+ * Version 0 is all zeros and version i sets bits_per_version bits that
+ * are clear in version i - 1, like RandomSet in the benchmark driver.
+ * Bit positions come from a counter-based generator keyed by (seed,
+ * version, draw), so versions are drawn in parallel and only the rare
+ * redraws of already set bits run in a sequential pass.  A built
+ * workload can be saved and later memory-mapped, which makes repeated
+ * benchmark runs skip generation entirely.
+ */
+class Workload {
+  public:
+    explicit Workload(const WorkloadSpec &spec_ref) : spec(spec_ref) {}
+
+    ~Workload() {
+        unmap();
+    }
+
+    Workload(const Workload &) = delete;
+    Workload &operator=(const Workload &) = delete;
+
+    /**
+     * Generate the deltas.  Returns false if a version cannot find
+     * enough clear bits, i.e. the bitmap is (nearly) full.
+     */
+    bool build(int threads = 0) {
+        unmap();
+        int n = std::max(0, spec.versions);
+        int k = std::max(0, spec.bits_per_version);
+        int total_bits = spec.bitmap_len * 8;
+        if (total_bits > 65536) return false;
+
+        // Draw the first k positions of every version in parallel.
+        std::vector<uint16_t> drawn((size_t)n * k);
+        parallel_ranges(n, threads, [&](int begin, int end) {
+            for (int v = std::max(begin, 1); v < end; v++) {
+                for (int d = 0; d < k; d++) {
+                    drawn[(size_t)v * k + d] = draw(v, d, total_bits);
+                }
+            }
+        });
+
+        // Keep the draws that hit a clear bit and redraw the others.
+        owned_offsets.assign(n + 1, 0);
+        owned_positions.clear();
+        owned_positions.reserve(drawn.size());
+        std::vector<uint8_t> current(spec.bitmap_len, 0);
+        for (int v = 0; v < n; v++) {
+            owned_offsets[v] = owned_positions.size();
+            if (v == 0) continue;
+            int set = 0;
+            uint64_t extra = k;
+            uint64_t max_draws = (uint64_t)k * 200 + 200;
+            for (int d = 0; set < k; d++) {
+                uint16_t pos;
+                if (d < k) {
+                    pos = drawn[(size_t)v * k + d];
+                } else if (extra < max_draws) {
+                    pos = draw(v, extra++, total_bits);
+                } else {
+                    return false;
+                }
+                uint8_t mask = 1 << (7 - pos % 8);
+                if (current[pos / 8] & mask) continue;
+                current[pos / 8] |= mask;
+                owned_positions.push_back(pos);
+                set++;
+            }
+        }
+        owned_offsets[n] = owned_positions.size();
+        offsets = owned_offsets.data();
+        positions = owned_positions.data();
+        version_cnt = n;
+        return true;
+    }
+
+    /**
+     * Write the workload to path, atomically replacing any older file.
+     */
+    bool save(const std::string &path) const {
+        if (offsets == nullptr) return false;
+        WorkloadFileHeader header = make_header();
+        std::string tmp_path = path + ".tmp";
+        {
+            std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!out) return false;
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char *>(offsets),
+                      (version_cnt + 1) * sizeof(uint64_t));
+            out.write(reinterpret_cast<const char *>(positions),
+                      header.total_deltas * sizeof(uint16_t));
+            if (!out) return false;
+        }
+        return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+
+    /**
+     * Memory-map a workload saved with the same spec.  Returns false,
+     * leaving the workload empty, if the file is missing or differs.
+     */
+    bool map(const std::string &path) {
+        unmap();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        void *addr = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(WorkloadFileHeader)) {
+            addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (addr == MAP_FAILED) return false;
+
+        const WorkloadFileHeader *header = static_cast<const WorkloadFileHeader *>(addr);
+        WorkloadFileHeader expected = make_header();
+        size_t n = spec.versions > 0 ? spec.versions : 0;
+        size_t size = sizeof(WorkloadFileHeader) + (n + 1) * sizeof(uint64_t);
+        bool valid = memcmp(header->magic, WORKLOAD_MAGIC, sizeof(WORKLOAD_MAGIC)) == 0 &&
+                     header->seed == expected.seed && header->versions == expected.versions &&
+                     header->bitmap_len == expected.bitmap_len &&
+                     header->bits_per_version == expected.bits_per_version &&
+                     header->first_csn == expected.first_csn &&
+                     (size_t)st.st_size == size + header->total_deltas * sizeof(uint16_t);
+        if (!valid) {
+            munmap(addr, st.st_size);
+            return false;
+        }
+        mapped = addr;
+        mapped_bytes = st.st_size;
+        offsets = reinterpret_cast<const uint64_t *>(header + 1);
+        positions = reinterpret_cast<const uint16_t *>(offsets + n + 1);
+        version_cnt = (int)n;
+        return true;
+    }
+
+    /**
+     * Map the cached workload at path, or build it and save it there.
+     * An empty path disables the cache.
+     */
+    bool load_or_build(const std::string &path, int threads = 0) {
+        if (!path.empty() && map(path)) return true;
+        if (!build(threads)) return false;
+        if (!path.empty()) save(path);
+        return true;
+    }
+
+    int size() const { return version_cnt; }
+
+    int csn(int i) const { return spec.first_csn + i; }
+
+    /**
+     * Bit positions version i sets on top of version i - 1.
+     */
+    const uint16_t *delta(int i) const { return positions + offsets[i]; }
+
+    int delta_cnt(int i) const { return (int)(offsets[i + 1] - offsets[i]); }
+
+    bool is_mapped() const { return mapped != nullptr; }
+
+    const WorkloadSpec &get_spec() const { return spec; }
+
+    /**
+     * Apply version i's delta to version i - 1 in place.
+     */
+    void apply(int i, uint8_t *bitmap) const {
+        const uint16_t *d = delta(i);
+        for (int k = 0; k < delta_cnt(i); k++) {
+            bitmap[d[k] / 8] ^= (1 << (7 - d[k] % 8));
+        }
+    }
+
+    /**
+     * Reconstruct versions [begin, end) into out[0 .. end - begin), each
+     * of bitmap_len bytes.  The range is split across threads; each
+     * thread replays the deltas before its slice once.
+     */
+    void materialize(int begin, int end, uint8_t *const *out, int threads = 0) const {
+        begin = std::max(0, begin);
+        end = std::min(end, version_cnt);
+        if (begin >= end) return;
+        parallel_ranges(end - begin, threads, [&](int from, int to) {
+            uint8_t *bitmap = out[from];
+            memset(bitmap, 0, spec.bitmap_len);
+            for (int i = 1; i <= begin + from; i++) apply(i, bitmap);
+            for (int i = from + 1; i < to; i++) {
+                memcpy(out[i], out[i - 1], spec.bitmap_len);
+                apply(begin + i, out[i]);
+            }
+        });
+    }
+
+  private:
+    WorkloadSpec spec;
+    int version_cnt = 0;
+    const uint64_t *offsets = nullptr;                    // version_cnt + 1 delta offsets
+    const uint16_t *positions = nullptr;
+    std::vector<uint64_t> owned_offsets;                  // Storage of a built workload
+    std::vector<uint16_t> owned_positions;
+    void *mapped = nullptr;                               // Mapping of a cached workload
+    size_t mapped_bytes = 0;
+
+    static uint64_t mix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    /**
+     * Draw number d of version v: a bit position in [0, total_bits).
+     */
+    uint16_t draw(uint64_t v, uint64_t d, int total_bits) const {
+        uint64_t x = mix(mix(spec.seed ^ mix(v)) + d);
+        return (uint16_t)(((x >> 32) * (uint64_t)total_bits) >> 32);
+    }
+
+    WorkloadFileHeader make_header() const {
+        WorkloadFileHeader header;
+        memcpy(header.magic, WORKLOAD_MAGIC, sizeof(WORKLOAD_MAGIC));
+        header.seed = spec.seed;
+        header.versions = spec.versions;
+        header.bitmap_len = spec.bitmap_len;
+        header.bits_per_version = spec.bits_per_version;
+        header.first_csn = spec.first_csn;
+        header.total_deltas = offsets ? offsets[version_cnt] : 0;
+        return header;
+    }
+
+    void unmap() {
+        if (mapped != nullptr) munmap(mapped, mapped_bytes);
+        mapped = nullptr;
+        mapped_bytes = 0;
+        offsets = nullptr;
+        positions = nullptr;
+        version_cnt = 0;
+    }
+
+    /**
+     * Run fn(begin, end) over contiguous slices of [0, n).
+     */
+    template <class Fn>
+    static void parallel_ranges(int n, int threads, Fn fn) {
+        if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::max(1, std::min(threads, n / 64 + 1));
+        std::vector<std::thread> workers;
+        int slice = (n + threads - 1) / threads;
+        for (int t = 1; t < threads; t++) {
+            int begin = std::min(n, t * slice);
+            int end = std::min(n, begin + slice);
+            if (begin < end) workers.emplace_back(fn, begin, end);
+        }
+        fn(0, std::min(n, slice));
+        for (auto &w : workers) w.join();
+    }
+};
+
+#endif // WORKLOAD_H
@@ -15,6 +15,7 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <functional>
 #include <list>
 #include <mutex>
 #include <random>
@@ -26,6 +27,20 @@
 //#define Original_HexaDB
 //#define test_memory
 //#define Rubbish_Delete
+//#define Pipeline_Commit
+//#define Replica_Test
+//#define Lock_Profile
+//#define Monotone_Delete
+//#define Matrix_Group
+//#define Block_Partition
+//#define Seeded_Workload
+//#define Compact_RowGroup
+//#define Scan_Benchmark
+//#define Delta_Reference
+//#define Incremental_Checkpoint
+//#define Position_Tree
+//#define Appendable_Length
+//#define Fork_Test
 
 #ifdef Original_HexaDB
     /**
@@ -38,6 +53,39 @@
      * and differential encoding.
      */
     #include "HierDiffController.h"
+#ifdef Replica_Test
+    /**
+     * Diff log shipping to a replica process on the same machine.
+     */
+    #include "DiffLogReplication.h"
+    #include <sys/wait.h>
+#endif
+#ifdef Block_Partition
+    /**
+     * Independent per-block versioning of the same workload.
+     */
+    #include "BlockPartitionedController.h"
+#endif
+#ifdef Compact_RowGroup
+    /**
+     * One-word row groups that upgrade on their first update.
+     */
+    #include "CompactRowGroup.h"
+    const int compact_row_groups = 1024;
+#endif
+#ifdef Incremental_Checkpoint
+    /**
+     * Incremental checkpoints to a segment chain on disk.
+     */
+    #include "Checkpoint.h"
+#endif
+#endif
+#ifdef Seeded_Workload
+    /**
+     * Seeded versions generated in parallel and cached on disk.
+     */
+    #include "Workload.h"
+    const uint64_t workload_seed = 1;
 #endif
 
 /**
@@ -126,8 +174,7 @@ const int haimin_distence = 1;
  */
 void RandomSet(uint8_t *bitmap, int num) {
     int max_tryTimes = 200;
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    static thread_local std::mt19937 gen(std::random_device{}());
     std::uniform_int_distribution<> bitmap_dist(0, BITMAP_SIZE - 1);
     std::uniform_int_distribution<> bitset_dist(0, 7);
 
@@ -213,8 +260,8 @@ class Curr_TSN_List {
         if (tsn_list.size() >= max_size) {
             std::random_device rd;
             std::mt19937 gen(rd());
-            std::uniform_int_distribution<> tsn_list_random_delete(0, max_size - 1);
-            for (int j = 0; j < delete_size; j++) {
+            for (int j = 0; j < delete_size && !tsn_list.empty(); j++) {
+                std::uniform_int_distribution<> tsn_list_random_delete(0, tsn_list.size() - 1);
                 int erase_pos = tsn_list_random_delete(gen);
                 tsn_list.erase(tsn_list.begin() + erase_pos);
             }
@@ -292,6 +339,743 @@ double Test_bitmap_controller_no_verify(Curr_TSN_List &tsn_list,
     return curr_tsn.size() / (duration / 1000000.0);
 }
 
+#ifndef Original_HexaDB
+/**
+ * Compare estimate_read_cost with what get_bitmap_as_of actually reads
+ * for every CSN in csns: the version that answers it, its encoding and
+ * length, and the reference and diff bytes it touches.  Prints the
+ * disagreements under name and returns their number.
+ */
+int Check_read_cost_estimates(BitmapController &bitmap_controller, const std::vector<int> &csns,
+                              const char *name) {
+    std::vector<uint8_t> result(BITMAP_SIZE);
+    int encoding_errors = 0;
+    int bytes_errors = 0;
+    size_t estimated_bytes = 0;
+    size_t read_bytes = 0;
+    for (int csn : csns) {
+        ReadCostEstimate estimate = bitmap_controller.estimate_read_cost(csn);
+        ReadTrace trace;
+        bool ok = bitmap_controller.get_bitmap_as_of(csn, result.data(), nullptr, &trace);
+        if (ok != (estimate.found && estimate.ready)) {
+            encoding_errors++;
+            continue;
+        }
+        if (!ok) continue;
+        if (estimate.version_csn != trace.version_csn || estimate.encoding != trace.encoding ||
+            estimate.bitmap_len != trace.bitmap_len) {
+            encoding_errors++;
+        }
+        size_t touched = trace.reference_bytes + trace.diff_bytes;
+        if (estimate.diff_bytes != trace.diff_bytes || estimate.bytes_touched != touched) {
+            bytes_errors++;
+        }
+        estimated_bytes += estimate.bytes_touched;
+        read_bytes += touched;
+    }
+    std::cout << "read cost estimates (" << name << "): " << csns.size() << " CSNs, "
+              << estimated_bytes << " bytes estimated, " << read_bytes << " bytes read, "
+              << encoding_errors << " wrong versions or encodings, " << bytes_errors
+              << " wrong byte counts" << std::endl;
+    return encoding_errors + bytes_errors;
+}
+#endif
+
+/**
+ * Snapshot age, in CSNs behind the newest reserved CSN, that the
+ * reader pool queries during the concurrent phase.
+ */
+enum SnapshotAge {
+    AGE_LATEST,                                           // Always the newest snapshot
+    AGE_RECENT,                                           // Geometric with mean snapshot_age_mean
+    AGE_UNIFORM                                           // Uniform over every committed snapshot
+};
+
+const int concurrent_duration_ms = 200;                   // Length of the concurrent phase
+const int concurrent_write_ms = 100;                      // Writers add versions only this long
+const int concurrent_max_commits = 4096;                  // Versions writers add after the generated ones
+const SnapshotAge snapshot_age = AGE_RECENT;
+const int snapshot_age_mean = 16;
+#ifdef Pipeline_Commit
+const int64_t own_commit_wait_us = 100000;                // Longest a writer waits to read its commit
+#endif
+
+/**
+ * Operation count and log2 latency histogram of a thread pool.
+ */
+struct PoolCounters {
+    uint64_t ops = 0;
+    uint64_t failed = 0;
+    uint64_t latency_ns = 0;
+    uint64_t hist[LOCK_HIST_BUCKETS] = {};
+
+    void record(uint64_t ns, bool ok) {
+        int b = 63 - __builtin_clzll(ns | 1);
+        hist[b < LOCK_HIST_BUCKETS ? b : LOCK_HIST_BUCKETS - 1]++;
+        latency_ns += ns;
+        ops++;
+        if (!ok) failed++;
+    }
+
+    void merge(const PoolCounters &other) {
+        ops += other.ops;
+        failed += other.failed;
+        latency_ns += other.latency_ns;
+        for (int i = 0; i < LOCK_HIST_BUCKETS; i++) hist[i] += other.hist[i];
+    }
+
+    void print(std::ostream &os, const char *name, double seconds) const {
+        os << name << ": " << ops << " ops, " << (int64_t)(seconds > 0 ? ops / seconds : 0)
+           << " op/s, latency avg " << (ops ? latency_ns / ops : 0) << " ns p50<"
+           << LockSiteSnapshot::quantile(hist, 0.5) << " p99<"
+           << LockSiteSnapshot::quantile(hist, 0.99) << ", " << failed << " failed" << std::endl;
+    }
+};
+
+/**
+ * Draw the CSN a reader queries when newest_csn is the newest visible
+ * CSN and first_csn the oldest committed one.
+ */
+int Draw_snapshot(std::mt19937 &gen, int first_csn, int newest_csn) {
+    int age = 0;
+    switch (snapshot_age) {
+    case AGE_RECENT:
+        age = std::geometric_distribution<>(1.0 / (snapshot_age_mean + 1))(gen);
+        break;
+    case AGE_UNIFORM:
+        age = std::uniform_int_distribution<>(0, newest_csn - first_csn)(gen);
+        break;
+    default:
+        break;
+    }
+    return std::max(first_csn, newest_csn - age);
+}
+
+/**
+ * Concurrent phase: an independently sized writer pool commits the
+ * generated versions, then keeps committing new ones for
+ * concurrent_write_ms, while a reader pool queries snapshots for
+ * concurrent_duration_ms.  The first version must already be committed.
+ * Writers always commit every generated version; the newest added
+ * version, if any, is appended to bitmap_list and tsn_list so that later
+ * phases verify it too.
+ *
+ * Reads are split by whether a writer was active when they started, so
+ * the tail of the phase measures readers alone and quantifies the
+ * reader-writer interference.  HierDiff readers draw snapshots at or
+ * below the controller's visible CSN, so a snapshot is never waited on.
+ * Original readers, which have no visibility watermark, draw them at or
+ * below the newest reserved CSN and read at once; a snapshot whose
+ * content is still being inserted yields the zeroed placeholder and is
+ * counted as a success, so their error count does not reflect it.
+ * With Pipeline_Commit each writer then reads its own commit back: it
+ * waits in wait_for_csn until the pipeline publishes it and compares the
+ * version with what it submitted.  The wait latency, timeouts and wrong
+ * reads are reported separately from the commit latency.
+ */
+void Run_concurrent_phase(BitmapController &bitmap_controller, std::list<InputBitmap> &bitmap_list,
+                          Curr_TSN_List &tsn_list, std::mutex &csn_lock,
+                          int num_insert_threads, int num_query_threads) {
+    auto pos = std::next(bitmap_list.rbegin());
+    int first_csn = bitmap_list.back().bitmap_csn;
+    int last_csn = bitmap_list.front().bitmap_csn;
+    std::vector<uint8_t> latest(bitmap_list.front().input_bitmap,
+                                bitmap_list.front().input_bitmap + BITMAP_SIZE);
+    int added = 0;
+    std::atomic<int> reserved_csn(first_csn);
+    std::atomic<int> active_writers(num_insert_threads);
+    std::atomic<bool> start(false);
+    std::vector<PoolCounters> writer_counters(num_insert_threads);
+#ifdef Pipeline_Commit
+    std::vector<PoolCounters> own_read_counters(num_insert_threads);
+    std::atomic<int> own_read_errors(0);
+#endif
+    std::vector<PoolCounters> shared_counters(num_query_threads);
+    std::vector<PoolCounters> solo_counters(num_query_threads);
+    auto begin = std::chrono::steady_clock::now();
+    auto deadline = begin;
+    auto write_deadline = begin;
+    std::atomic<int64_t> writers_end_ns(0);
+
+    auto elapsed_ns = [&] {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_insert_threads; t++) {
+        threads.emplace_back([&, t] {
+            std::vector<uint8_t> staged(BITMAP_SIZE);
+#ifdef Pipeline_Commit
+            std::vector<uint8_t> own_read(BITMAP_SIZE);
+#endif
+            while (!start.load()) std::this_thread::yield();
+            while (true) {
+                auto op_start = std::chrono::steady_clock::now();
+#ifndef Original_HexaDB
+                bitmap_controller.admit_commit();
+#endif
+                csn_lock.lock();
+                int csn;
+                uint8_t *content;
+                if (pos != bitmap_list.rend()) {
+                    csn = pos->bitmap_csn;
+                    content = pos->input_bitmap;
+                    pos++;
+                } else if (added < concurrent_max_commits && op_start < write_deadline) {
+                    RandomSet(latest.data(), haimin_distence);
+                    memcpy(staged.data(), latest.data(), BITMAP_SIZE);
+                    csn = ++last_csn;
+                    content = staged.data();
+                    added++;
+                } else {
+                    csn_lock.unlock();
+                    break;
+                }
+#ifdef Original_HexaDB
+                OneBitmap *bitmap = nullptr;
+                bitmap_controller.insert_null(csn, bitmap);
+                reserved_csn.store(csn);
+                csn_lock.unlock();
+                bool ok = bitmap_controller.insert_bitmap_content(content, bitmap);
+#else
+                BitmapRef *ref = nullptr;
+                CompressedBitmap *bitmap = nullptr;
+                bool ok = bitmap_controller.insert_null(csn, content, ref, bitmap);
+                reserved_csn.store(csn);
+                csn_lock.unlock();
+                if (ref != nullptr) {
+#ifdef Pipeline_Commit
+                    ok = bitmap_controller.submit_bitmap_content(ref, bitmap, content);
+#else
+                    ok = bitmap_controller.insert_bitmap_content(ref, bitmap, content);
+#endif
+                }
+#endif
+                writer_counters[t].record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - op_start).count(), ok);
+#ifdef Pipeline_Commit
+                if (!ok) continue;
+                auto wait_start = std::chrono::steady_clock::now();
+                bool visible = bitmap_controller.wait_for_csn(csn, own_commit_wait_us);
+                own_read_counters[t].record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - wait_start).count(), visible);
+                if (visible && (!bitmap_controller.get_bitmap(csn, own_read.data()) ||
+                                memcmp(own_read.data(), content, BITMAP_SIZE) != 0)) {
+                    own_read_errors.fetch_add(1);
+                }
+#endif
+            }
+            if (active_writers.fetch_sub(1) == 1) writers_end_ns.store(elapsed_ns());
+        });
+    }
+    for (int t = 0; t < num_query_threads; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937 gen(std::random_device{}());
+            std::vector<uint8_t> query_result(BITMAP_SIZE);
+            while (!start.load()) std::this_thread::yield();
+            while (std::chrono::steady_clock::now() < deadline) {
+                bool shared = active_writers.load() > 0;
+#ifdef Original_HexaDB
+                int csn = Draw_snapshot(gen, first_csn, reserved_csn.load());
+#else
+                int csn = Draw_snapshot(gen, first_csn,
+                                        std::max(first_csn, bitmap_controller.get_visible_csn()));
+#endif
+                auto op_start = std::chrono::steady_clock::now();
+                bool ok = bitmap_controller.get_bitmap(csn, query_result.data());
+                uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - op_start).count();
+                (shared ? shared_counters : solo_counters)[t].record(ns, ok);
+            }
+        });
+    }
+    begin = std::chrono::steady_clock::now();
+    deadline = begin + std::chrono::milliseconds(concurrent_duration_ms);
+    write_deadline = begin + std::chrono::milliseconds(concurrent_write_ms);
+    start.store(true);
+    for (auto &thread : threads) thread.join();
+
+    if (added > 0) {
+        uint8_t *newest = new uint8_t[BITMAP_SIZE];
+        memcpy(newest, latest.data(), BITMAP_SIZE);
+        bitmap_list.emplace(bitmap_list.begin(), last_csn, newest);
+        tsn_list.insert_new_tsn(last_csn);
+    }
+
+    PoolCounters writers, shared_readers, solo_readers;
+    for (auto &c : writer_counters) writers.merge(c);
+    for (auto &c : shared_counters) shared_readers.merge(c);
+    for (auto &c : solo_counters) solo_readers.merge(c);
+    double writer_seconds = writers_end_ns.load() / 1e9;
+    double total_seconds = concurrent_duration_ms / 1000.0;
+    std::cout << "concurrent phase: " << num_insert_threads << " writers, " << num_query_threads
+              << " readers, " << concurrent_duration_ms << " ms, " << added
+              << " versions added" << std::endl;
+    writers.print(std::cout, "  writers", writer_seconds);
+#ifdef Pipeline_Commit
+    PoolCounters own_reads;
+    for (auto &c : own_read_counters) own_reads.merge(c);
+    own_reads.print(std::cout, "  waits for own commit", writer_seconds);
+    std::cout << "  own commit reads: " << own_reads.failed << " timeouts, "
+              << own_read_errors.load() << " read errors" << std::endl;
+#endif
+    shared_readers.print(std::cout, "  readers with writers", writer_seconds);
+    solo_readers.print(std::cout, "  readers alone", std::max(0.0, total_seconds - writer_seconds));
+}
+
+#ifdef Scan_Benchmark
+const int scan_queries = 256;                             // Snapshots scanned per read API variant
+const int scan_max_commits = 10000;                       // Commits issued while scans run
+const int32_t scan_filter_max = 1 << 30;                  // Predicate: value < scan_filter_max
+
+/**
+ * Synthetic column chunk of a row group, one value per row.
+ */
+struct ColumnChunk {
+    std::vector<int32_t> values;
+
+    explicit ColumnChunk(uint64_t seed) : values(BITMAP_SIZE * 8) {
+        std::mt19937 gen(seed);
+        for (auto &v : values) v = (int32_t)(gen() >> 1);
+    }
+};
+
+/**
+ * SUM(value) WHERE value < scan_filter_max over the rows a delete
+ * bitmap leaves visible (a set bit marks a deleted row).
+ */
+int64_t Scan_visible(const ColumnChunk &chunk, const uint8_t *bitmap) {
+    int64_t sum = 0;
+    for (int i = 0; i < BITMAP_SIZE; i++) {
+        uint8_t deleted = bitmap[i];
+        if (deleted == 0xFF) continue;
+        const int32_t *v = chunk.values.data() + i * 8;
+        for (int j = 0; j < 8; j++) {
+            if (!(deleted & (0x80 >> j)) && v[j] < scan_filter_max) sum += v[j];
+        }
+    }
+    return sum;
+}
+
+/**
+ * A read API variant: reconstruct the snapshots csns (or the one at
+ * ts_us) into bufs and hand each visibility bitmap to consume.
+ */
+struct ScanRead {
+    const char *name;
+    int batch;                                            // Snapshots per call
+    std::function<bool(const std::vector<int> &csns, int64_t ts_us, std::vector<uint8_t *> &bufs,
+                       const std::function<void(const uint8_t *)> &consume)> read;
+};
+
+/**
+ * End-to-end scans at random published snapshots while a writer keeps
+ * committing.  Reports scan throughput and the share of scan time
+ * spent reconstructing visibility.  The writer's newest version, if
+ * any, is appended to bitmap_list and tsn_list.
+ */
+void Run_scan_benchmark(BitmapController &bitmap_controller, std::list<InputBitmap> &bitmap_list,
+                        Curr_TSN_List &tsn_list, int num_scan_threads) {
+    ColumnChunk chunk(7);
+    std::vector<ScanRead> variants;
+    variants.push_back({"get_bitmap", 1, [&](const std::vector<int> &csns, int64_t,
+                                             std::vector<uint8_t *> &bufs,
+                                             const std::function<void(const uint8_t *)> &consume) {
+        if (!bitmap_controller.get_bitmap(csns[0], bufs[0])) return false;
+        consume(bufs[0]);
+        return true;
+    }});
+    variants.push_back({"get_bitmap_at_time", 1, [&](const std::vector<int> &, int64_t ts_us,
+                                                     std::vector<uint8_t *> &bufs,
+                                                     const std::function<void(const uint8_t *)> &consume) {
+        if (!bitmap_controller.get_bitmap_at_time(ts_us, bufs[0])) return false;
+        consume(bufs[0]);
+        return true;
+    }});
+#ifndef Original_HexaDB
+    variants.push_back({"get_bitmap_as_of", 1, [&](const std::vector<int> &csns, int64_t,
+                                                   std::vector<uint8_t *> &bufs,
+                                                   const std::function<void(const uint8_t *)> &consume) {
+        if (!bitmap_controller.get_bitmap_as_of(csns[0], bufs[0])) return false;
+        consume(bufs[0]);
+        return true;
+    }});
+    variants.push_back({"get_bitmaps", 8, [&](const std::vector<int> &csns, int64_t,
+                                              std::vector<uint8_t *> &bufs,
+                                              const std::function<void(const uint8_t *)> &consume) {
+        std::vector<bool> found;
+        if (bitmap_controller.get_bitmaps(csns, bufs, found) != (int)csns.size()) return false;
+        for (uint8_t *buf : bufs) consume(buf);
+        return true;
+    }});
+    variants.push_back({"get_bitmap_view", 1, [&](const std::vector<int> &csns, int64_t,
+                                                  std::vector<uint8_t *> &bufs,
+                                                  const std::function<void(const uint8_t *)> &consume) {
+        ReferenceView view;
+        if (bitmap_controller.get_bitmap_view(csns[0], view) && view.length() == BITMAP_SIZE) {
+            consume(view.data());
+            return true;
+        }
+        if (!bitmap_controller.get_bitmap(csns[0], bufs[0])) return false;
+        consume(bufs[0]);
+        return true;
+    }});
+#endif
+
+    std::atomic<int> published(bitmap_list.front().bitmap_csn);
+    std::atomic<bool> scans_done(false);
+    int64_t scan_start_us = wall_clock_us();
+    uint8_t *bitmap = new uint8_t[BITMAP_SIZE];
+    memcpy(bitmap, bitmap_list.front().input_bitmap, BITMAP_SIZE);
+    std::thread writer([&] {
+        for (int i = 0; i < scan_max_commits && !scans_done.load(); i++) {
+            int csn = published.load() + 1;
+            RandomSet(bitmap, haimin_distence);
+#ifdef Original_HexaDB
+            OneBitmap *version = nullptr;
+            bitmap_controller.insert_null(csn, version);
+            bitmap_controller.insert_bitmap_content(bitmap, version);
+#else
+            BitmapRef *ref = nullptr;
+            CompressedBitmap *version = nullptr;
+            bitmap_controller.insert_null(csn, bitmap, ref, version);
+            if (ref != nullptr) bitmap_controller.insert_bitmap_content(ref, version, bitmap);
+#endif
+            published.store(csn);
+        }
+    });
+
+    for (const ScanRead &variant : variants) {
+        std::atomic<uint64_t> visibility_ns(0), total_ns(0);
+        std::atomic<int> scans(0), failed(0);
+        std::atomic<int64_t> checksum(0);
+        int calls = (scan_queries + variant.batch - 1) / variant.batch;
+        double duration = ParallelForStable(0, calls, num_scan_threads, [&](size_t row, size_t threadId) {
+            thread_local std::mt19937 gen(std::random_device{}());
+            std::vector<int> csns(variant.batch);
+            std::vector<uint8_t *> bufs(variant.batch);
+            std::vector<uint8_t> storage((size_t)variant.batch * BITMAP_SIZE);
+            for (int k = 0; k < variant.batch; k++) {
+                csns[k] = std::uniform_int_distribution<>(0, published.load())(gen);
+                bufs[k] = storage.data() + (size_t)k * BITMAP_SIZE;
+            }
+            int64_t now_us = wall_clock_us();
+            int64_t ts_us = now_us - std::uniform_int_distribution<int64_t>(
+                0, std::max<int64_t>(0, now_us - scan_start_us))(gen);
+
+            auto start = std::chrono::steady_clock::now();
+            auto first_consume = start;
+            bool consumed = false;
+            int64_t sum = 0;
+            bool ok = variant.read(csns, ts_us, bufs, [&](const uint8_t *bitmap) {
+                if (!consumed) first_consume = std::chrono::steady_clock::now();
+                consumed = true;
+                sum += Scan_visible(chunk, bitmap);
+            });
+            auto end = std::chrono::steady_clock::now();
+            if (!ok) {
+                failed++;
+                return;
+            }
+            visibility_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(first_consume - start).count();
+            total_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            scans += variant.batch;
+            checksum += sum;
+        });
+        double seconds = duration / 1000000.0;
+        std::cout << "scan " << variant.name << ": " << (int)(scans / seconds) << " scan/s, "
+                  << (int64_t)((double)scans * BITMAP_SIZE * 8 / seconds) << " row/s, visibility "
+                  << (total_ns ? 100.0 * visibility_ns / total_ns : 0.0) << "% of scan time, "
+                  << failed << " failed (checksum " << checksum % 1000 << ")" << std::endl;
+    }
+    scans_done.store(true);
+    writer.join();
+    int commits = published.load() - bitmap_list.front().bitmap_csn;
+    std::cout << "scan commits during scans: " << commits << std::endl;
+    if (commits > 0) {
+        bitmap_list.emplace(bitmap_list.begin(), published.load(), bitmap);
+        tsn_list.insert_new_tsn(published.load());
+    } else {
+        delete[] bitmap;
+    }
+}
+#endif
+
+#if defined(Incremental_Checkpoint) && !defined(Original_HexaDB)
+const int checkpoint_rounds = 32;                         // Checkpoints after the first, full one
+const int checkpoint_round_commits = 64;                  // Commits between two checkpoints
+const int checkpoint_gc_rounds = 8;                       // Rounds between GC passes
+
+/**
+ * Incremental checkpoints: a full checkpoint of the controller, then
+ * checkpoint_rounds rounds that each commit checkpoint_round_commits new
+ * versions and checkpoint again, with a GC pass every
+ * checkpoint_gc_rounds rounds so that older groups change too.  The
+ * chain is then reopened from disk and restored into a new controller,
+ * whose reads must match the controller's for every version, and which
+ * must accept a further commit.  The newest version is appended to
+ * bitmap_list and tsn_list.
+ */
+void Run_checkpoint_benchmark(BitmapController &bitmap_controller,
+                              std::list<InputBitmap> &bitmap_list, Curr_TSN_List &tsn_list) {
+    CheckpointConfig checkpoint_config;
+    checkpoint_config.dir = "checkpoint_chain";
+    std::filesystem::remove_all(checkpoint_config.dir);
+    std::vector<int> csns;
+    for (auto &input : bitmap_list) csns.push_back(input.bitmap_csn);
+    std::vector<uint8_t> latest(bitmap_list.front().input_bitmap,
+                                bitmap_list.front().input_bitmap + BITMAP_SIZE);
+    int last_csn = bitmap_list.front().bitmap_csn;
+    auto elapsed_ms = [](std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since)
+            .count();
+    };
+
+    double full_ms = 0;
+    double incremental_ms = 0;
+    uint64_t full_bytes = 0;
+    int failed = 0;
+    {
+        CheckpointChain chain(checkpoint_config);
+        auto start = std::chrono::steady_clock::now();
+        failed += !chain.checkpoint(bitmap_controller);
+        full_ms = elapsed_ms(start);
+        full_bytes = chain.get_stats().bytes_written;
+        for (int round = 0; round < checkpoint_rounds; round++) {
+            for (int i = 0; i < checkpoint_round_commits; i++) {
+                RandomSet(latest.data(), haimin_distence);
+                BitmapRef *ref = nullptr;
+                CompressedBitmap *bitmap = nullptr;
+                bitmap_controller.insert_null(++last_csn, latest.data(), ref, bitmap);
+                if (ref != nullptr) bitmap_controller.insert_bitmap_content(ref, bitmap, latest.data());
+                csns.push_back(last_csn);
+            }
+            if ((round + 1) % checkpoint_gc_rounds == 0) {
+                bitmap_controller.collect_garbage(wall_clock_us(), tsn_list.get_curr_tsn());
+            }
+            start = std::chrono::steady_clock::now();
+            failed += !chain.checkpoint(bitmap_controller);
+            incremental_ms += elapsed_ms(start);
+        }
+        chain.wait_for_merge();
+        CheckpointStats stats = chain.get_stats();
+        std::cout << "checkpoint: full " << full_bytes << " bytes in " << full_ms
+                  << " ms, incremental avg "
+                  << (stats.bytes_written - full_bytes) / checkpoint_rounds << " bytes in "
+                  << incremental_ms / checkpoint_rounds << " ms, " << failed << " failed"
+                  << std::endl;
+        stats.print(std::cout);
+    }
+
+    CheckpointChain reopened(checkpoint_config);
+    std::vector<int> restored_tsn_list;
+    BitmapController restored(restored_tsn_list);
+    auto start = std::chrono::steady_clock::now();
+    bool restore_ok = reopened.restore(restored);
+    double restore_ms = elapsed_ms(start);
+    int read_errors = 0;
+    std::vector<uint8_t> expected(BITMAP_SIZE);
+    std::vector<uint8_t> actual(BITMAP_SIZE);
+    for (int csn : csns) {
+        bool has = bitmap_controller.get_bitmap(csn, expected.data());
+        if (restored.get_bitmap(csn, actual.data()) != has ||
+            (has && memcmp(expected.data(), actual.data(), BITMAP_SIZE) != 0)) {
+            read_errors++;
+        }
+    }
+    std::vector<uint8_t> next(latest);
+    RandomSet(next.data(), haimin_distence);
+    BitmapRef *ref = nullptr;
+    CompressedBitmap *bitmap = nullptr;
+    restored.insert_null(last_csn + 1, next.data(), ref, bitmap);
+    if (ref != nullptr) restored.insert_bitmap_content(ref, bitmap, next.data());
+    bool commit_ok = restored.get_bitmap(last_csn + 1, actual.data()) &&
+                     memcmp(next.data(), actual.data(), BITMAP_SIZE) == 0;
+    std::cout << "checkpoint restore: " << (restore_ok ? "ok" : "failed") << " in " << restore_ms
+              << " ms, " << read_errors << " read errors over " << csns.size()
+              << " versions, commit after restore " << (commit_ok ? "ok" : "failed")
+              << std::endl;
+    std::filesystem::remove_all(checkpoint_config.dir);
+
+    uint8_t *newest = new uint8_t[BITMAP_SIZE];
+    memcpy(newest, latest.data(), BITMAP_SIZE);
+    bitmap_list.emplace(bitmap_list.begin(), last_csn, newest);
+    tsn_list.insert_new_tsn(last_csn);
+}
+#endif
+
+#if defined(Appendable_Length) && !defined(Original_HexaDB)
+const int append_versions = 4096;                         // Versions of the growing bitmap
+const int append_start_len = 64;                          // Logical length of the first version
+const int append_max_step = 16;                           // Bytes appended per version at most
+
+/**
+ * Appendable bitmaps: a fresh controller commits append_versions
+ * versions whose logical length grows from append_start_len towards
+ * BITMAP_SIZE.  Each version appends visible rows and deletes
+ * haimin_distence old ones, so appended ranges are stored as runs and
+ * the head group is replaced whenever a version outgrows its reference.
+ * Writers reserve in CSN order and fill concurrently; every version is
+ * then read back and must match in length and content.
+ */
+void Run_append_benchmark(const ControllerConfig &controller_config, std::vector<int> &tsn_list,
+                          int num_insert_threads) {
+    std::mt19937 gen(17);
+    std::vector<std::vector<uint8_t>> versions(append_versions);
+    std::vector<uint8_t> current(BITMAP_SIZE, 0);
+    int len = append_start_len;
+    for (int i = 0; i < append_versions; i++) {
+        int grown = std::min(BITMAP_SIZE, len + std::uniform_int_distribution<>(0, append_max_step)(gen));
+        memset(current.data() + len, 0xFF, grown - len);
+        for (int k = 0; k < haimin_distence; k++) {
+            int bit = std::uniform_int_distribution<>(0, len * 8 - 1)(gen);
+            current[bit / 8] &= ~(1 << (7 - bit % 8));
+        }
+        len = grown;
+        versions[i].assign(current.begin(), current.begin() + len);
+    }
+
+    BitmapController controller(tsn_list, controller_config);
+    std::mutex csn_lock;
+    int next_version = 0;
+    double insert_duration = ParallelForStable(0, append_versions, num_insert_threads,
+                                               [&](size_t row, size_t threadId) {
+        BitmapRef *ref = nullptr;
+        CompressedBitmap *bitmap = nullptr;
+        csn_lock.lock();
+        int i = next_version++;
+        std::vector<uint8_t> &version = versions[i];
+        controller.insert_null(i, version.data(), ref, bitmap, (int)version.size());
+        csn_lock.unlock();
+        if (ref != nullptr) {
+            controller.insert_bitmap_content(ref, bitmap, version.data(), (int)version.size());
+        }
+    });
+
+    int read_errors = 0;
+    std::vector<uint8_t> result(BITMAP_SIZE);
+    for (int i = 0; i < append_versions; i++) {
+        int result_len = 0;
+        if (!controller.get_bitmap(i, result.data(), &result_len) ||
+            result_len != (int)versions[i].size() ||
+            memcmp(result.data(), versions[i].data(), result_len) != 0) {
+            read_errors++;
+        }
+    }
+    std::cout << "append phase: " << append_versions << " versions grown from " << append_start_len
+              << " to " << versions.back().size() << " bytes, "
+              << (int)(append_versions / (insert_duration / 1000000.0)) << " insert/s, "
+              << read_errors << " read errors" << std::endl;
+    std::vector<int> csns(append_versions);
+    for (int i = 0; i < append_versions; i++) csns[i] = i;
+    Check_read_cost_estimates(controller, csns, "append");
+    controller.get_stats().print(std::cout);
+}
+#endif
+
+#if defined(Fork_Test) && !defined(Original_HexaDB)
+const int fork_base_versions = 1024;                      // Versions committed before the fork
+const int fork_branch_versions = 512;                     // Versions each side commits after it
+const int fork_snapshot_stride = 64;                      // Every this many CSNs is an active snapshot
+
+/**
+ * Forked version history: a heap controller commits fork_base_versions
+ * versions and is forked, then both sides commit fork_branch_versions
+ * divergent versions under the same CSNs and run GC with the same
+ * active snapshots.  The original is destroyed, the fork runs GC once
+ * more over the groups it now owns alone, and every CSN is read back
+ * from it: a retained version must match the fork's history, and the
+ * active snapshots and the newest version must be retained.
+ */
+void Run_fork_benchmark(const ControllerConfig &controller_config, int num_query_threads) {
+    std::vector<int> fork_tsn_list;
+    std::unique_ptr<BitmapController> original(
+        new BitmapController(fork_tsn_list, controller_config));
+    int total_versions = fork_base_versions + fork_branch_versions;
+    std::vector<std::vector<uint8_t>> original_versions(total_versions);
+    std::vector<std::vector<uint8_t>> fork_versions(total_versions);
+    std::vector<uint8_t> latest(BITMAP_SIZE, 0);
+
+    auto commit = [](BitmapController &controller, int csn, std::vector<uint8_t> &content) {
+        BitmapRef *ref = nullptr;
+        CompressedBitmap *bitmap = nullptr;
+        controller.insert_null(csn, content.data(), ref, bitmap);
+        if (ref != nullptr) controller.insert_bitmap_content(ref, bitmap, content.data());
+    };
+    for (int csn = 0; csn < fork_base_versions; csn++) {
+        if (csn > 0) RandomSet(latest.data(), haimin_distence);
+        original_versions[csn] = latest;
+        fork_versions[csn] = latest;
+        commit(*original, csn, original_versions[csn]);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<BitmapController> forked = original->fork();
+    double fork_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint8_t> original_latest(latest);
+    std::vector<uint8_t> fork_latest(latest);
+    for (int csn = fork_base_versions; csn < total_versions; csn++) {
+        RandomSet(original_latest.data(), haimin_distence);
+        RandomSet(fork_latest.data(), haimin_distence);
+        original_versions[csn] = original_latest;
+        fork_versions[csn] = fork_latest;
+        commit(*original, csn, original_versions[csn]);
+        commit(*forked, csn, fork_versions[csn]);
+    }
+
+    std::vector<int> snapshots;
+    for (int csn = 0; csn < total_versions; csn += fork_snapshot_stride) snapshots.push_back(csn);
+    auto verify = [&](BitmapController &controller, std::vector<std::vector<uint8_t>> &versions,
+                      int &retained) {
+        std::vector<int> csns(total_versions);
+        std::vector<char> found(total_versions);
+        std::vector<char> matched(total_versions);
+        for (int csn = 0; csn < total_versions; csn++) csns[csn] = csn;
+        std::vector<std::unique_ptr<uint8_t[]>> scratch(num_query_threads);
+        for (auto &buf : scratch) buf.reset(new uint8_t[BITMAP_SIZE]);
+        ParallelForStable(0, total_versions, num_query_threads, [&](size_t row, size_t threadId) {
+            uint8_t *buf = scratch[threadId].get();
+            found[row] = controller.get_bitmap(csns[row], buf);
+            matched[row] = found[row] && memcmp(buf, versions[row].data(), BITMAP_SIZE) == 0;
+        });
+        int errors = 0;
+        retained = 0;
+        for (int csn = 0; csn < total_versions; csn++) {
+            bool required = csn == total_versions - 1 ||
+                            std::binary_search(snapshots.begin(), snapshots.end(), csn);
+            retained += found[csn];
+            if ((found[csn] && !matched[csn]) || (required && !found[csn])) errors++;
+        }
+        return errors;
+    };
+
+    size_t original_freed = original->collect_garbage(wall_clock_us(), snapshots);
+    size_t fork_freed = forked->collect_garbage(wall_clock_us(), snapshots);
+    int original_retained = 0;
+    int shared_retained = 0;
+    int original_errors = verify(*original, original_versions, original_retained);
+    int shared_errors = verify(*forked, fork_versions, shared_retained);
+    original.reset();
+    size_t fork_freed_alone = forked->collect_garbage(wall_clock_us(), snapshots);
+    int fork_retained = 0;
+    int fork_errors = verify(*forked, fork_versions, fork_retained);
+
+    std::cout << "fork phase: forked " << fork_base_versions << " versions in " << fork_ms
+              << " ms, " << fork_branch_versions << " divergent versions per side" << std::endl;
+    std::cout << "  original: gc freed " << original_freed << " bytes, " << original_retained
+              << " versions retained, " << original_errors << " read errors" << std::endl;
+    std::cout << "  fork while shared: gc freed " << fork_freed << " bytes, " << shared_retained
+              << " versions retained, " << shared_errors << " read errors" << std::endl;
+    std::cout << "  fork after original destroyed: gc freed " << fork_freed_alone << " bytes, "
+              << fork_retained << " versions retained, " << fork_errors << " read errors"
+              << std::endl;
+    forked->get_stats().print(std::cout);
+}
+#endif
+
 void print_tsn_list(Curr_TSN_List tsn_list) {
     std::cout << "TSN list size: " << tsn_list.get_curr_tsn().size() << std::endl;
     std::cout << "[";
@@ -314,12 +1098,60 @@ int main(int argc, char** argv) {
     std::cout << "num_query_threads: " << num_query_threads << std::endl;
 
     Curr_TSN_List tsn_list;
+#ifdef Original_HexaDB
     BitmapController bitmap_controller(tsn_list.tsn_list);
+#else
+    ControllerConfig controller_config;
+#ifdef Pipeline_Commit
+    controller_config.pipelined_commit = true;
+#endif
+#ifdef Monotone_Delete
+    controller_config.monotone_deletes = true;
+#endif
+#ifdef Delta_Reference
+    controller_config.delta_references = true;
+#endif
+#ifdef Position_Tree
+    controller_config.position_trees = true;
+#endif
+#ifdef Matrix_Group
+    controller_config.matrix_groups = true;
+    controller_config.group_versions = MAX_MATRIX_VERSIONS;
+#endif
+    BitmapController bitmap_controller(tsn_list.tsn_list, controller_config);
+#endif
 #ifdef test_memory
     uint8_t *pre_bitmap = new uint8_t[BITMAP_SIZE];
 #else
     std::list<InputBitmap> bitmap_list;
 #endif
+#if defined(Seeded_Workload) && !defined(test_memory)
+    WorkloadSpec workload_spec;
+    workload_spec.seed = workload_seed;
+    workload_spec.versions = max_insert;
+    workload_spec.bitmap_len = BITMAP_SIZE;
+    workload_spec.bits_per_version = haimin_distence;
+    Workload workload(workload_spec);
+    auto workload_start = std::chrono::steady_clock::now();
+    std::string workload_path = "workload_" + std::to_string(workload_seed) + "_" +
+                                std::to_string(max_insert) + "_" +
+                                std::to_string(haimin_distence) + ".bin";
+    if (!workload.load_or_build(workload_path)) {
+        throw std::runtime_error("Workload generation failed!!");
+    }
+    std::vector<uint8_t *> workload_bitmaps(max_insert);
+    for (auto &bitmap : workload_bitmaps) bitmap = new uint8_t[BITMAP_SIZE];
+    workload.materialize(0, max_insert, workload_bitmaps.data());
+    for (int i = 0; i < max_insert; i++) {
+        bitmap_list.emplace(bitmap_list.begin(), workload.csn(i), workload_bitmaps[i]);
+        tsn_list.insert_new_tsn(workload.csn(i));
+    }
+    std::cout << "workload: " << max_insert << " versions "
+              << (workload.is_mapped() ? "mapped" : "built") << " in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - workload_start).count()
+              << " ms" << std::endl;
+#else
     int now_csn = 0;
     bool first_flag = true;
     for (int i = 0; i < max_insert; i++) {
@@ -344,18 +1176,39 @@ int main(int argc, char** argv) {
 #endif
         tsn_list.insert_new_tsn(new_bitmap.bitmap_csn);
     }
+#endif
+#if defined(Replica_Test) && !defined(Original_HexaDB)
+    int replica_sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, replica_sockets) != 0) {
+        throw std::runtime_error("socketpair() failed");
+    }
+    pid_t replica_pid = fork();
+    if (replica_pid == 0) {
+        close(replica_sockets[0]);
+        std::vector<int> replica_tsn_list;
+        DiffLogReplica replica(replica_sockets[1], replica_tsn_list);
+        replica.run_until_eof();
+        std::cout << "replica applied " << replica.get_records_applied()
+                  << " records, lag " << replica.get_lag_csn() << " CSNs" << std::endl;
+        int replica_throughput = Test_bitmap_controller(bitmap_list, tsn_list,
+                                                        replica.get_controller(), 1);
+        std::cout << "replica query QPS: " << replica_throughput << " query/s" << std::endl;
+        _exit(0);
+    }
+    close(replica_sockets[1]);
+    DiffLogPublisher publisher;
+    publisher.add_replica(replica_sockets[0]);
+    publisher.attach(bitmap_controller);
+#endif
     std::mutex csn_lock;
     auto pos = bitmap_list.rbegin();
 #ifdef Original_HexaDB
-    double duration = ParallelForStable(0, max_insert, num_insert_threads, [&](size_t row, size_t threadId) {
-        OneBitmap *bitmap = nullptr;
-        csn_lock.lock();
-        auto local_pos = pos;
-        bitmap_controller.insert_null(local_pos->bitmap_csn, bitmap);
-        pos++;
-        csn_lock.unlock();
-        bitmap_controller.insert_bitmap_content(local_pos->input_bitmap, bitmap);
-    });
+    OneBitmap *ini_bitmap = nullptr;
+    bitmap_controller.insert_null(pos->bitmap_csn, ini_bitmap);
+    bitmap_controller.insert_bitmap_content(pos->input_bitmap, ini_bitmap);
+    Run_concurrent_phase(bitmap_controller, bitmap_list, tsn_list, csn_lock,
+                         num_insert_threads, num_query_threads);
+    print_lock_profile(std::cout, collect_lock_profile());
 #else
     BitmapRef *ini_ref = nullptr;
     CompressedBitmap *ini_bitmap = nullptr;
@@ -363,44 +1216,123 @@ int main(int argc, char** argv) {
     if (ini_ref != nullptr) {
         bitmap_controller.insert_bitmap_content(ini_ref, ini_bitmap, pos->input_bitmap);
     }
-    pos++;
-    std::mutex query_sum_lock;
-    int query_sum = 0;
-    double duration = ParallelForStable(0, max_insert - 1, num_insert_threads, [&](size_t row, size_t threadId) {
-        if(threadId % 2 == 0){
-            BitmapRef *ref = nullptr;
-            CompressedBitmap *bitmap = nullptr;
-            csn_lock.lock();
-            auto local_pos = pos;
-            bitmap_controller.insert_null(local_pos->bitmap_csn, local_pos->input_bitmap, ref, bitmap);
-            pos++;
-            csn_lock.unlock();
-            if (ref != nullptr) {
-                bitmap_controller.insert_bitmap_content(ref, bitmap, local_pos->input_bitmap);
-            }
-        }else{
-            auto local_pos = pos;
-            if(local_pos != bitmap_list.rbegin()){
-                local_pos--;
-            }
-            uint8_t* query_result = new uint8_t[BITMAP_SIZE]();
-            bitmap_controller.get_bitmap(local_pos->bitmap_csn, query_result);
-            query_sum_lock.lock();
-            query_sum ++;
-            query_sum_lock.unlock();
-        }
-    });
-
+    Run_concurrent_phase(bitmap_controller, bitmap_list, tsn_list, csn_lock,
+                         num_insert_threads, num_query_threads);
+#ifdef Pipeline_Commit
+    bitmap_controller.drain_pipeline();
+#endif
+    bitmap_controller.get_stats().print(std::cout);
+#ifdef Replica_Test
+    publisher.heartbeat(bitmap_controller.get_high_water_csn(),
+                        bitmap_controller.get_visible_csn());
+    publisher.close_all();
+    std::cout << "publisher sent " << publisher.get_records_sent() << " records, "
+              << publisher.get_publish_waits() << " waits for queue space" << std::endl;
+    waitpid(replica_pid, nullptr, 0);
+#endif
 #endif
-    int insert_throughput = tsn_list.get_curr_tsn().size() / (duration / 1000000.0);
-    int query_throughput = query_sum / (duration / 1000000.0);
-    std::cout << "insert QPS: " << insert_throughput << " insert/s" << std::endl;
-    std::cout << "query QPS: " << query_throughput << " query/s" << std::endl;
 #ifndef test_memory
     int throughput = Test_bitmap_controller(bitmap_list, tsn_list, bitmap_controller, num_query_threads);
     // int throughput = Test_bitmap_controller_no_verify(tsn_list, bitmap_controller, num_query_threads);
     std::cout << "query QPS: " << throughput << " query/s" << std::endl;
     std::cout << "tsn final size: " << tsn_list.get_curr_tsn().size() << std::endl;
+
+    uint8_t *time_travel_result = new uint8_t[BITMAP_SIZE]();
+    bool time_travel_ok =
+        bitmap_controller.get_bitmap_at_time(wall_clock_us(), time_travel_result) &&
+        memcmp(time_travel_result, bitmap_list.front().input_bitmap, BITMAP_SIZE) == 0;
+    std::cout << "time travel read at now: " << (time_travel_ok ? "ok" : "mismatch") << std::endl;
+    delete[] time_travel_result;
+#ifndef Original_HexaDB
+    std::vector<int> estimate_csns;
+    for (auto &input : bitmap_list) estimate_csns.push_back(input.bitmap_csn);
+    Check_read_cost_estimates(bitmap_controller, estimate_csns, "main");
+#endif
+#endif
+#if defined(Block_Partition) && !defined(Original_HexaDB) && !defined(test_memory)
+    BlockPartitionedController block_controller(tsn_list.tsn_list);
+    auto block_pos = bitmap_list.rbegin();
+    double block_duration = ParallelForStable(0, bitmap_list.size(), num_insert_threads, [&](size_t row, size_t threadId) {
+        BlockReservation reservation;
+        csn_lock.lock();
+        auto local_pos = block_pos;
+        block_controller.insert_null(local_pos->bitmap_csn, local_pos->input_bitmap, reservation);
+        block_pos++;
+        csn_lock.unlock();
+        block_controller.insert_bitmap_content(reservation, local_pos->input_bitmap);
+    });
+    int block_errors = 0;
+    uint8_t *block_result = new uint8_t[BITMAP_SIZE];
+    for (auto &input : bitmap_list) {
+        if (!block_controller.get_bitmap(input.bitmap_csn, block_result) ||
+            memcmp(block_result, input.input_bitmap, BITMAP_SIZE) != 0) {
+            block_errors++;
+        }
+    }
+    delete[] block_result;
+    std::cout << "block partition insert QPS: "
+              << (int)(bitmap_list.size() / (block_duration / 1000000.0)) << " insert/s, "
+              << block_errors << " read errors" << std::endl;
+    block_controller.get_stats().print(std::cout);
+    std::vector<int> block_snapshots = tsn_list.get_curr_tsn();
+    size_t block_freed = block_controller.collect_garbage(wall_clock_us(), block_snapshots);
+    int block_gc_errors = 0;
+    block_result = new uint8_t[BITMAP_SIZE];
+    for (auto &input : bitmap_list) {
+        if (std::find(block_snapshots.begin(), block_snapshots.end(), input.bitmap_csn) ==
+            block_snapshots.end()) {
+            continue;
+        }
+        if (!block_controller.get_bitmap(input.bitmap_csn, block_result) ||
+            memcmp(block_result, input.input_bitmap, BITMAP_SIZE) != 0) {
+            block_gc_errors++;
+        }
+    }
+    delete[] block_result;
+    std::cout << "block partition gc: freed " << block_freed << " bytes, "
+              << block_gc_errors << " read errors over " << block_snapshots.size()
+              << " snapshots" << std::endl;
+    block_controller.get_stats().print(std::cout);
+#endif
+#if defined(Scan_Benchmark) && !defined(test_memory)
+    Run_scan_benchmark(bitmap_controller, bitmap_list, tsn_list, num_query_threads);
+#endif
+#if defined(Incremental_Checkpoint) && !defined(Original_HexaDB) && !defined(test_memory)
+    Run_checkpoint_benchmark(bitmap_controller, bitmap_list, tsn_list);
+#endif
+#if defined(Appendable_Length) && !defined(Original_HexaDB)
+    Run_append_benchmark(controller_config, tsn_list.tsn_list, num_insert_threads);
+#endif
+#if defined(Fork_Test) && !defined(Original_HexaDB)
+    Run_fork_benchmark(controller_config, num_query_threads);
+#endif
+#if defined(Compact_RowGroup) && !defined(Original_HexaDB) && !defined(test_memory)
+    RowGroupContext row_group_context(tsn_list.tsn_list);
+    std::vector<CompactRowGroup> row_groups;
+    for (int i = 0; i < compact_row_groups; i++) row_groups.emplace_back(0);
+    for (auto it = bitmap_list.rbegin(); it != bitmap_list.rend(); ++it) {
+        row_groups[0].insert(it->bitmap_csn, it->input_bitmap, row_group_context);
+    }
+    int row_group_errors = 0;
+    uint8_t *row_group_result = new uint8_t[BITMAP_SIZE];
+    for (auto &input : bitmap_list) {
+        if (!row_groups[0].get_bitmap_as_of(input.bitmap_csn, row_group_result) ||
+            memcmp(row_group_result, input.input_bitmap, BITMAP_SIZE) != 0) {
+            row_group_errors++;
+        }
+    }
+    delete[] row_group_result;
+    size_t row_group_bytes = 0;
+    for (size_t i = 1; i < row_groups.size(); i++) row_group_bytes += row_groups[i].memory_bytes();
+    std::cout << "compact row groups: updated group " << row_groups[0].memory_bytes()
+              << " bytes (" << row_group_errors << " read errors), "
+              << row_groups.size() - 1 << " untouched groups " << row_group_bytes
+              << " bytes" << std::endl;
+#endif
+#ifndef Original_HexaDB
+    size_t gc_freed = bitmap_controller.collect_garbage(wall_clock_us(), tsn_list.get_curr_tsn());
+    std::cout << "gc freed: " << gc_freed << " bytes, memory: "
+              << bitmap_controller.get_stats().memory_bytes << " bytes" << std::endl;
 #endif
     return 0;
 }
\ No newline at end of file